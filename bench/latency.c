@@ -0,0 +1,160 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This benchmark is a part of the ALEFT Project.
+ *       It measures the latency of one small file, from the
+ *       creation of the socket until the whole file has been
+ *       received, with and without TCP Fast Open.
+ * */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../lib/aleft.h"
+
+/*
+The sender and the receiver run in the same process, over loopback, so
+that only the connection and the transfer are timed, not the startup of
+two programs. A file is done once the receiver has checked it.
+
+    - fastopen: the session connects by itself (aleft_session_connect()),
+      the header and the first block go with the SYN once the kernel
+      has a Fast Open cookie.
+    - connect:  connect() first, as before Fast Open, then the session.
+
+The receiver's side of Fast Open has to be enabled for the first one to
+make a difference: net.ipv4.tcp_fastopen & 2.
+*/
+
+#define BENCH_PORT "11137"
+#define BENCH_RUNS 300
+#define BENCH_WARMUP 20
+
+static const size_t sizes[] = { 1024, 4096, 16384, 65536 };
+
+typedef struct {
+    int listener;
+    int done[2];   // the receiver writes a Byte in it for each file received
+} Receiver;
+
+static void* receive_files(void* arg) {
+    Receiver* receiver = arg;
+    while (true) {
+        int sock = aleft_accept(receiver->listener, NULL, 0);
+        if (sock == -1)
+            break;
+
+        AleftSession* session = aleft_recv(sock, -1, NULL);
+        char status = session && aleft_session_run(session) == ALEFT_DONE ? 'Y' : 'N';
+        aleft_session_free(session);
+        close(sock);
+        if (write(receiver->done[1], &status, 1) != 1)
+            break;
+    }
+    return NULL;
+}
+
+static double now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static int by_value(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Sends one file of size Bytes and waits until it has been received
+ *
+ * @return its latency in µs, -1 if it failed
+ * */
+static double send_one(Receiver* receiver, const char* data, size_t size, bool fastOpen) {
+    struct sockaddr_storage address;
+    socklen_t addressLen;
+
+    double start = now_us();
+    int sock = aleft_socket("127.0.0.1", BENCH_PORT, &address, &addressLen);
+    if (sock == -1)
+        return -1;
+    if (!fastOpen && connect(sock, (struct sockaddr*) &address, addressLen) == -1) {
+        close(sock);
+        return -1;
+    }
+
+    AleftSession* session = aleft_send_buffer(sock, "bench.bin", data, size, NULL);
+    if (fastOpen)
+        aleft_session_connect(session, (struct sockaddr*) &address, addressLen);
+    int status = aleft_session_run(session);
+    aleft_session_free(session);
+
+    char received;
+    bool ok = read(receiver->done[0], &received, 1) == 1 && received == 'Y';
+    double latency = now_us() - start;
+
+    close(sock);
+    return status == ALEFT_DONE && ok ? latency : -1;
+}
+
+int main(void) {
+    Receiver receiver;
+    if ((receiver.listener = aleft_listen(BENCH_PORT, 16)) == -1 || pipe(receiver.done) == -1) {
+        fprintf(stderr, "Cannot listen on port %s\n", BENCH_PORT);
+        return EXIT_FAILURE;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, receive_files, &receiver) != 0)
+        return EXIT_FAILURE;
+
+    FILE* sysctl = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r");
+    int tcpFastOpen = -1;
+    if (sysctl) {
+        if (fscanf(sysctl, "%d", &tcpFastOpen) != 1)
+            tcpFastOpen = -1;
+        fclose(sysctl);
+    }
+    printf("net.ipv4.tcp_fastopen = %d%s\n", tcpFastOpen,
+           tcpFastOpen >= 0 && (tcpFastOpen & 3) != 3 ? " (Fast Open can't be used, 3 is needed)" : "");
+    printf("%d files per size and mode, latency in µs\n\n", BENCH_RUNS);
+    printf("%8s  %-9s %8s %8s %8s\n", "size", "mode", "median", "p90", "p99");
+
+    char* data = malloc(sizes[sizeof sizes / sizeof *sizes - 1]);
+    if (!data)
+        return EXIT_FAILURE;
+    memset(data, 'a', sizes[sizeof sizes / sizeof *sizes - 1]);
+
+    double latencies[BENCH_RUNS];
+    for (size_t s = 0; s < sizeof sizes / sizeof *sizes; s++) {
+        for (int mode = 0; mode < 2; mode++) {
+            bool fastOpen = mode == 1;
+            // The first connections get the Fast Open cookie and warm the caches
+            for (int i = 0; i < BENCH_WARMUP; i++)
+                send_one(&receiver, data, sizes[s], fastOpen);
+
+            int failed = 0;
+            for (int i = 0; i < BENCH_RUNS; i++)
+                if ((latencies[i] = send_one(&receiver, data, sizes[s], fastOpen)) < 0)
+                    failed++;
+            qsort(latencies, BENCH_RUNS, sizeof *latencies, by_value);
+
+            double* ok = latencies + failed; // the failed ones are sorted first
+            int nbOk = BENCH_RUNS - failed;
+            if (nbOk == 0) {
+                printf("%6zuKB  %-9s all failed\n", sizes[s] / 1024, fastOpen ? "fastopen" : "connect");
+                continue;
+            }
+            printf("%6zuKB  %-9s %8.1f %8.1f %8.1f%s\n", sizes[s] / 1024, fastOpen ? "fastopen" : "connect",
+                   ok[nbOk/2], ok[nbOk*9/10], ok[nbOk*99/100], failed ? " (some failed)" : "");
+        }
+    }
+
+    free(data);
+    return EXIT_SUCCESS;
+}
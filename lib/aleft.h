@@ -0,0 +1,479 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This library is a part of the ALEFT Project.
+ *       It implements the ALEFT protocol, so that files can be
+ *       sent and received from any program, not only from the
+ *       sender and receiver executables.
+ * */
+#ifndef __ALEFT__
+#define __ALEFT__
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+[HEADER]
+    ALEFT_FILENAME_LEN Bytes of filename
+        e.g. "h e l l o . t x t \0 ... \0 "
+              1 2 3 4 5 6 7 8 9 10 ... 128
+    It's a file name, not a path: no '/', neither "." nor "..".
+
+    ALEFT_FILESIZE_LEN Bytes of file size
+        e.g. "      2048" = 2048 Bytes
+
+[FILE CONTENT]
+    Everything that follows the header is the sent file.
+    The number of Bytes from this section is the size written in the HEADER.
+
+[CHECKSUM]
+    ALEFT_CHECKSUM_LEN Bytes that follow the file content: the XXH64 hash
+    (seed 0) of the file content, in hexadecimal.
+        e.g. "d3b4e5c8e3a8e9f0"
+
+[STREAM]
+    If the size of the file is unknown (e.g. it's read from a pipe),
+    the ALEFT_FILESIZE_LEN Bytes of file size are ALEFT_STREAM_SIZE and the
+    file content is sent as a series of blocks, each one preceded by its
+    length on ALEFT_CHUNKSIZE_LEN Bytes. A block of length 0 ends the stream,
+    followed by the CHECKSUM of the whole content.
+        e.g. "hi.txt\0...\0        -1         4bonj         3our         0" + CHECKSUM
+
+[PULL MODE]
+    The receiver can also fetch ranges of files from a sender serving
+    a directory. On one connection, it sends as many requests as it wants,
+    each one answered before the next one is read.
+
+    [RANGE REQUEST], ALEFT_REQUEST_LEN Bytes
+        ALEFT_FILENAME_LEN Bytes of file name, as in the HEADER
+        ALEFT_FILESIZE_LEN Bytes of offset
+        ALEFT_FILESIZE_LEN Bytes of length
+        1 Byte: ALEFT_WANT_CHECKSUM if the range's checksum is wanted, ' ' otherwise
+            e.g. "hi.txt\0...\0      4096      1024H"
+
+    [RANGE REPLY], ALEFT_REPLY_LEN Bytes
+        ALEFT_FILESIZE_LEN Bytes of file size, ALEFT_NO_FILE if it can't be served
+        ALEFT_FILESIZE_LEN Bytes of file version (a hash of its modification
+            time, to the nanosecond, and of its inode), which changes if the file does
+        ALEFT_FILESIZE_LEN Bytes of length, shorter than asked at the end of the file
+    followed by the range's content and, if asked, its checksum.
+
+[PACK]
+    Many small files can be sent at once, as one file whose name ends with
+    ALEFT_PACK_SUFFIX (e.g. "photos.aleftpack" for the files of "photos").
+    Its content is:
+        ALEFT_PACK_MAGIC_LEN Bytes: ALEFT_PACK_MAGIC
+        ALEFT_FILESIZE_LEN Bytes: the number of files
+        for each file, a HEADER with its name and size (not a stream)
+        the contents of the files, one after another, in the same order
+    A pack is at most ALEFT_PACK_MAX_SIZE Bytes. A receiver that doesn't
+    know about packs saves it as any other file.
+*/
+
+#define ALEFT_FILENAME_LEN 128
+#define ALEFT_FILESIZE_LEN 10
+#define ALEFT_HEADER_LEN (ALEFT_FILENAME_LEN + ALEFT_FILESIZE_LEN)
+#define ALEFT_MAX_SIZE 9999999999LL
+
+#define ALEFT_CHECKSUM_LEN 16
+#define ALEFT_CHECKSUM_STRIPE 32
+
+#define ALEFT_STREAM_SIZE "        -1"
+#define ALEFT_CHUNKSIZE_LEN 10
+#define ALEFT_STREAM_CHUNK (64*1024)
+
+#define ALEFT_REQUEST_LEN (ALEFT_FILENAME_LEN + 2*ALEFT_FILESIZE_LEN + 1)
+#define ALEFT_REPLY_LEN (3*ALEFT_FILESIZE_LEN)
+#define ALEFT_WANT_CHECKSUM 'H'
+#define ALEFT_NO_FILE "        -1"
+
+#define ALEFT_PACK_SUFFIX ".aleftpack"
+
+// The receiver's own files, no received file can take their names (see aleft_check_name())
+#define ALEFT_JOURNAL_NAME ".aleft.journal"
+#define ALEFT_TMP_PREFIX ".aleft-"
+#define ALEFT_PACK_MAGIC "ALEFTPACK1"
+#define ALEFT_PACK_MAGIC_LEN 10
+#define ALEFT_PACK_HEADER_LEN (ALEFT_PACK_MAGIC_LEN + ALEFT_FILESIZE_LEN)
+#define ALEFT_PACK_MAX_SIZE (256LL*1024*1024)
+
+// Default number of Bytes read from a file and sent at once
+#define ALEFT_CHUNK_SIZE (64*1024)
+#define ALEFT_MAX_CHUNK_SIZE (1024*1024)
+
+// What aleft_session_step() returns
+#define ALEFT_DONE 0
+#define ALEFT_AGAIN 1
+#define ALEFT_ERROR -1
+
+// What an on_header callback returns to refuse a file
+#define ALEFT_REFUSE -2
+
+// Max number of sockets a receive session forwards what it receives to
+#define ALEFT_MAX_RELAYS 16
+
+/**
+ * State of an XXH64 hash being computed
+ * */
+typedef struct {
+    unsigned long long acc[4];
+    unsigned long long totalSize;
+    unsigned char tail[ALEFT_CHECKSUM_STRIPE]; // Bytes waiting for a whole stripe
+    size_t tailSize;
+} AleftChecksum;
+
+/**
+ * How the received Bytes went from the socket to the file
+ * */
+typedef struct {
+    unsigned long long copiedBytes;  // through a user space buffer
+    unsigned long long splicedBytes; // socket -> pipe -> file, or the other way
+    unsigned long long mappedBytes;  // mmap()ed from the socket
+    unsigned long long relayedBytes; // forwarded to the relays, all of them together
+} AleftStats;
+
+/**
+ * A range of a file, as requested in pull mode
+ * */
+typedef struct {
+    char name[ALEFT_FILENAME_LEN+1];
+    long long offset;
+    long long length;
+    bool checksum; // true if the range's checksum is wanted
+} AleftRange;
+
+/**
+ * What a sender answers to a range request
+ * */
+typedef struct {
+    long long fileSize; // -1 if the file can't be served
+    long long version;  // changes when the file does
+    long long length;   // of the range sent
+} AleftReply;
+
+typedef struct AleftSession AleftSession;
+
+/**
+ * What a session tells its owner. Every callback is optional.
+ *
+ * on_header: a receive session got the header. Returns the descriptor in
+ *            which write the file, -1 to receive it in memory, or
+ *            ALEFT_REFUSE to end the session in error. Only called if the
+ *            session has been created without a descriptor.
+ *            size is -1 for a stream.
+ * on_progress: some Bytes of the file content have been sent or received.
+ *              total is -1 for a stream.
+ * on_complete: the session is over, status is ALEFT_DONE or ALEFT_ERROR.
+ * on_relay_error: nothing more is forwarded to the relay sock, which failed.
+ *                 The session itself goes on.
+ * maxMemory: the most Bytes a file received in memory may take, a bigger
+ *            one ends the session in error. 0 for no limit: the memory
+ *            still grows only as the Bytes arrive, whatever the header says.
+ * */
+typedef struct {
+    int (*on_header)(AleftSession* session, const char* name, long long size, void* user);
+    void (*on_progress)(AleftSession* session, unsigned long long done, long long total, void* user);
+    void (*on_complete)(AleftSession* session, int status, void* user);
+    void (*on_relay_error)(AleftSession* session, int sock, const char* error, void* user);
+    void* user;
+    unsigned long long maxMemory;
+} AleftCallbacks;
+
+/**
+ * Writes a header
+ *
+ * @param header where to write the ALEFT_HEADER_LEN Bytes of header
+ * @param name file name, see aleft_check_name()
+ * @param size file size, -1 for a stream
+ *
+ * @return 0 if the header has been written
+ *         -1 if the name or the size doesn't fit
+ */
+int aleft_encode_header(char* header, const char* name, long long size);
+
+/**
+ * Checks a file name: shorter than ALEFT_FILENAME_LEN, not empty,
+ * and a name rather than a path (no '/', neither "." nor ".."),
+ * without control characters, and none of the receiver's own
+ * (ALEFT_JOURNAL_NAME, or starting with ALEFT_TMP_PREFIX).
+ *
+ * @return true if it's fine
+ */
+bool aleft_check_name(const char* name);
+
+/**
+ * Checks the format of a header: a NUL-padded name that passes
+ * aleft_check_name(), and a right-aligned size or ALEFT_STREAM_SIZE.
+ * Any ALEFT_HEADER_LEN Bytes can be given, nothing else is read.
+ *
+ * @param header the ALEFT_HEADER_LEN Bytes of header
+ *
+ * @return true if it's fine
+ */
+bool aleft_check_header(const char* header);
+
+/**
+ * Decodes a header that has been checked
+ *
+ * @param header the ALEFT_HEADER_LEN Bytes of header
+ * @param name where to write the name, ALEFT_FILENAME_LEN+1 Bytes
+ * @param size where to write the size, -1 for a stream
+ */
+void aleft_decode_header(const char* header, char* name, long long* size);
+
+/**
+ * Decodes a right-aligned decimal number of len Bytes (e.g. "      2048"),
+ * as the file size or the length of a block
+ *
+ * @return the number, or -1 if the field isn't one
+ */
+long long aleft_decode_length(const char* field, size_t len);
+
+/**
+ * Decodes the ALEFT_CHECKSUM_LEN hexadecimal digits of a checksum
+ *
+ * @return true if the field is a checksum
+ */
+bool aleft_decode_checksum(const char* field, unsigned long long* checksum);
+
+/**
+ * Writes a range request
+ *
+ * @param request where to write the ALEFT_REQUEST_LEN Bytes of request
+ *
+ * @return 0 if the request has been written
+ *         -1 if the name, the offset or the length doesn't fit
+ */
+int aleft_encode_request(char* request, const AleftRange* range);
+
+/**
+ * Checks and decodes a range request.
+ * Any ALEFT_REQUEST_LEN Bytes can be given, nothing else is read.
+ *
+ * @return true if it's a request
+ */
+bool aleft_decode_request(const char* request, AleftRange* range);
+
+/**
+ * Writes the ALEFT_REPLY_LEN Bytes of a range reply
+ */
+void aleft_encode_reply(char* reply, const AleftReply* answer);
+
+/**
+ * Checks and decodes a range reply.
+ * Any ALEFT_REPLY_LEN Bytes can be given, nothing else is read.
+ *
+ * @return true if it's a reply
+ */
+bool aleft_decode_reply(const char* reply, AleftReply* answer);
+
+/**
+ * @return true if name is the one of a pack: something followed by ALEFT_PACK_SUFFIX
+ */
+bool aleft_is_pack(const char* name);
+
+/**
+ * Writes the header of a pack, to be followed by count HEADERs
+ * written with aleft_encode_header(), then the files' contents
+ *
+ * @param header where to write the ALEFT_PACK_HEADER_LEN Bytes
+ *
+ * @return 0 if the header has been written, -1 if count doesn't fit
+ */
+int aleft_encode_pack(char* header, long long count);
+
+/**
+ * Checks a whole pack: its header, every HEADER of its index,
+ * that no two files have the same name, and that the files' sizes
+ * add up to what follows the index
+ *
+ * @return the number of files, -1 if it isn't a valid pack
+ */
+long long aleft_decode_pack(const char* pack, size_t size);
+
+/**
+ * Starts a new XXH64 hash
+ */
+void aleft_checksum_init(AleftChecksum* checksum);
+
+/**
+ * Adds size Bytes of data to the hash
+ */
+void aleft_checksum_update(AleftChecksum* checksum, const void* data, size_t size);
+
+/**
+ * @return the hash of all the data given to aleft_checksum_update()
+ */
+unsigned long long aleft_checksum_final(const AleftChecksum* checksum);
+
+/**
+ * Creates a listening TCP socket, with TCP Fast Open enabled
+ *
+ * @param port port of the socket
+ * @param backlog max number of pending connections
+ *
+ * @return the socket's file descriptor or -1 if an error has occured
+ */
+int aleft_listen(const char* port, int backlog);
+
+/**
+ * Waits for someone to connect to listener
+ *
+ * @param ip where to write the address of the new peer, may be NULL
+ * @param ipSize size of ip, INET6_ADDRSTRLEN is enough
+ *
+ * @return the connected socket or -1 if an error has occured
+ */
+int aleft_accept(int listener, char* ip, size_t ipSize);
+
+/**
+ * Resolves ip and port, and creates a TCP socket to connect to them
+ *
+ * @param address where to write the resolved address
+ * @param addressLen where to write its length
+ *
+ * @return the (unconnected) socket or -1 if an error has occured
+ */
+int aleft_socket(const char* ip, const char* port, struct sockaddr_storage* address, socklen_t* addressLen);
+
+/**
+ * Creates a session sending a file read from fd through sock.
+ *
+ * @param sock connected socket, or unconnected if aleft_session_connect() is used
+ * @param name file name, see aleft_check_name()
+ * @param fd descriptor to read the file from, from its current offset
+ * @param size size of the file, -1 to stream whatever fd gives until its end
+ *
+ * @return the session, or NULL if the name or the size doesn't fit
+ *         or if there's not enough memory
+ */
+AleftSession* aleft_send_fd(int sock, const char* name, int fd, long long size, const AleftCallbacks* callbacks);
+
+/**
+ * Creates a session sending size Bytes of data through sock.
+ * data isn't copied and has to stay valid until the session is freed.
+ *
+ * Same parameters and return values as aleft_send_fd().
+ */
+AleftSession* aleft_send_buffer(int sock, const char* name, const void* data, size_t size, const AleftCallbacks* callbacks);
+
+/**
+ * Creates a session receiving a file through sock
+ *
+ * @param fd descriptor in which write the file, or -1 to let on_header choose
+ *           (or receive the file in memory if there's no on_header)
+ *
+ * @return the session, or NULL if there's not enough memory
+ */
+AleftSession* aleft_recv(int sock, int fd, const AleftCallbacks* callbacks);
+
+/**
+ * Makes a send session connect its socket to address, with TCP Fast Open
+ * when it's available so that the header and the beginning of the file
+ * go with the SYN. Must be called before the first step.
+ */
+void aleft_session_connect(AleftSession* session, const struct sockaddr* address, socklen_t addressLen);
+
+/**
+ * Makes a receive session forward everything it receives (header, file
+ * content and checksum) to sock, a connected socket, so that the peer on
+ * the other side receives the same file at the same time. The Bytes
+ * spliced into the file are tee()d to sock without being copied.
+ * As splice() can't be told MSG_NOSIGNAL, SIGPIPE has to be ignored for
+ * a relay that disconnects to be reported rather than to kill the program.
+ * sock is made non-blocking, and isn't closed by the session. A relay that
+ * can't take more makes the session wait for its socket (see
+ * aleft_session_wait_fd()), so a slow relay slows the whole session down.
+ * Must be called before the first step.
+ *
+ * @return 0 if sock has been added
+ *         -1 if the session isn't a receive one, has started, or
+ *         already has ALEFT_MAX_RELAYS relays, or if its pipe can't be created
+ */
+int aleft_session_relay(AleftSession* session, int sock);
+
+/**
+ * Sets the number of Bytes read from a file and sent at once,
+ * up to ALEFT_MAX_CHUNK_SIZE. Can be changed at any time.
+ */
+void aleft_session_set_chunk_size(AleftSession* session, size_t chunkSize);
+
+/**
+ * Moves the transfer forward as much as possible without waiting for the sockets.
+ * The socket is made non-blocking. The files are read and written as they are,
+ * so a blocking pipe or terminal may block this function.
+ *
+ * @return ALEFT_AGAIN if a socket has to be waited for (see aleft_session_wait_fd())
+ *         ALEFT_DONE if the transfer is over
+ *         ALEFT_ERROR if an error has occured (see aleft_session_error())
+ */
+int aleft_session_step(AleftSession* session);
+
+/**
+ * @return the poll() events to wait for on aleft_session_wait_fd() before the next step
+ */
+short aleft_session_events(const AleftSession* session);
+
+/**
+ * @return the socket to wait for before the next step: the session's one,
+ *         or the socket of a relay that has to catch up
+ */
+int aleft_session_wait_fd(const AleftSession* session);
+
+/**
+ * Steps the session until it's over, waiting for its sockets with poll()
+ *
+ * @return ALEFT_DONE or ALEFT_ERROR
+ */
+int aleft_session_run(AleftSession* session);
+
+/**
+ * @return the session's socket
+ */
+int aleft_session_socket(const AleftSession* session);
+
+/**
+ * @return the file name, empty until a receive session got the header
+ */
+const char* aleft_session_name(const AleftSession* session);
+
+/**
+ * @return the file size, -1 for a stream
+ */
+long long aleft_session_size(const AleftSession* session);
+
+/**
+ * @return the file received in memory, and its size in *size.
+ *         NULL if the file isn't received in memory.
+ *         The session still owns it.
+ */
+const void* aleft_session_buffer(const AleftSession* session, size_t* size);
+
+/**
+ * @return how the Bytes have been moved
+ */
+const AleftStats* aleft_session_stats(const AleftSession* session);
+
+/**
+ * @return what went wrong, empty if nothing did
+ */
+const char* aleft_session_error(const AleftSession* session);
+
+/**
+ * Frees the session. Neither the socket nor the file are closed.
+ */
+void aleft_session_free(AleftSession* session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ALEFT__
@@ -0,0 +1,132 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This library is a part of the ALEFT Project.
+ *       C++ interface of libaleft, header-only: it only wraps aleft.h.
+ * */
+#ifndef __ALEFT_HPP__
+#define __ALEFT_HPP__
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "aleft.h"
+
+namespace aleft {
+
+/**
+ * A send or receive session, freed with the object.
+ * The callbacks can be set until the first step, and are all optional.
+ * */
+class Session {
+public:
+    // Returns the descriptor in which write the file, -1 to receive it in memory or ALEFT_REFUSE
+    std::function<int(const std::string& name, long long size)> onHeader;
+    std::function<void(unsigned long long done, long long total)> onProgress;
+    std::function<void(int status)> onComplete;
+    std::function<void(int sock, const std::string& error)> onRelayError;
+
+    /**
+     * Same as aleft_send_fd(), aleft_send_buffer() and aleft_recv()
+     *
+     * @throw std::invalid_argument if the name or the size doesn't fit
+     * @throw std::bad_alloc if there's not enough memory
+     * */
+    static std::unique_ptr<Session> sendFd(int sock, const std::string& name, int fd, long long size) {
+        std::unique_ptr<Session> session(new Session);
+        AleftCallbacks callbacks = session->callbacks();
+        session->session_ = aleft_send_fd(sock, name.c_str(), fd, size, &callbacks);
+        if (!session->session_)
+            throw std::invalid_argument("aleft: the name or the size doesn't fit");
+        return session;
+    }
+
+    static std::unique_ptr<Session> sendBuffer(int sock, const std::string& name, const void* data, size_t size) {
+        std::unique_ptr<Session> session(new Session);
+        AleftCallbacks callbacks = session->callbacks();
+        session->session_ = aleft_send_buffer(sock, name.c_str(), data, size, &callbacks);
+        if (!session->session_)
+            throw std::invalid_argument("aleft: the name or the size doesn't fit");
+        return session;
+    }
+
+    // maxMemory: see AleftCallbacks
+    static std::unique_ptr<Session> recv(int sock, int fd = -1, unsigned long long maxMemory = 0) {
+        std::unique_ptr<Session> session(new Session);
+        AleftCallbacks callbacks = session->callbacks();
+        callbacks.maxMemory = maxMemory;
+        session->session_ = aleft_recv(sock, fd, &callbacks);
+        if (!session->session_)
+            throw std::bad_alloc();
+        return session;
+    }
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    ~Session() { aleft_session_free(session_); }
+
+    void connect(const struct sockaddr* address, socklen_t addressLen) { aleft_session_connect(session_, address, addressLen); }
+    void setChunkSize(size_t chunkSize) { aleft_session_set_chunk_size(session_, chunkSize); }
+    bool relay(int sock) { return aleft_session_relay(session_, sock) == 0; }
+
+    int step() { return aleft_session_step(session_); }
+    short events() const { return aleft_session_events(session_); }
+    int waitFd() const { return aleft_session_wait_fd(session_); }
+    int run() { return aleft_session_run(session_); }
+
+    int socket() const { return aleft_session_socket(session_); }
+    std::string name() const { return aleft_session_name(session_); }
+    long long size() const { return aleft_session_size(session_); }
+    const void* buffer(size_t* size) const { return aleft_session_buffer(session_, size); }
+    const AleftStats& stats() const { return *aleft_session_stats(session_); }
+    std::string error() const { return aleft_session_error(session_); }
+
+    AleftSession* get() const { return session_; }
+
+private:
+    Session() : session_(nullptr) {}
+
+    AleftCallbacks callbacks() {
+        AleftCallbacks callbacks = AleftCallbacks();
+        callbacks.on_header = on_header;
+        callbacks.on_progress = on_progress;
+        callbacks.on_complete = on_complete;
+        callbacks.on_relay_error = on_relay_error;
+        callbacks.user = this;
+        return callbacks;
+    }
+
+    static int on_header(AleftSession*, const char* name, long long size, void* user) {
+        Session* self = static_cast<Session*>(user);
+        return self->onHeader ? self->onHeader(name, size) : -1;
+    }
+
+    static void on_progress(AleftSession*, unsigned long long done, long long total, void* user) {
+        Session* self = static_cast<Session*>(user);
+        if (self->onProgress)
+            self->onProgress(done, total);
+    }
+
+    static void on_complete(AleftSession*, int status, void* user) {
+        Session* self = static_cast<Session*>(user);
+        if (self->onComplete)
+            self->onComplete(status);
+    }
+
+    static void on_relay_error(AleftSession*, int sock, const char* error, void* user) {
+        Session* self = static_cast<Session*>(user);
+        if (self->onRelayError)
+            self->onRelayError(sock, error);
+    }
+
+    AleftSession* session_;
+};
+
+} // namespace aleft
+
+#endif // __ALEFT_HPP__
@@ -0,0 +1,114 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This library is a part of the ALEFT Project.
+ *       It implements the ALEFT protocol, so that files can be
+ *       sent and received from any program, not only from the
+ *       sender and receiver executables.
+ * */
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "aleft.h"
+
+// Max number of pending TCP Fast Open requests on a listening socket
+#define FASTOPEN_QUEUE_LEN 16
+
+int aleft_listen(const char* port, int backlog) {
+    int sockfd = -1;
+    struct addrinfo hints, *info, *p;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC; // IPv4 or IPv6
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE; // use my IP
+
+    if (getaddrinfo(NULL, port, &hints, &info) != 0)
+        return -1;
+
+    for (p = info; p != NULL; p = p->ai_next) {
+        if ((sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
+            continue;
+
+        /**
+         * Allows to lose the boring "Address already in use" error message
+         * by specifying the OS that this program is allowed to reuse the port
+         * */
+        int yaaas = 1;
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yaaas, sizeof(int));
+
+        if (bind(sockfd, p->ai_addr, p->ai_addrlen) == -1) {
+            close(sockfd);
+            sockfd = -1;
+            continue;
+        }
+
+        break;
+    }
+
+    freeaddrinfo(info);
+
+    if (sockfd == -1)
+        return -1;
+
+    /**
+     * Lets the sender put the header and the beginning of the file in its SYN
+     * (TCP Fast Open). If the kernel refuses, the usual handshake is used.
+     * */
+    int qlen = FASTOPEN_QUEUE_LEN;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof qlen);
+
+    if (listen(sockfd, backlog) == -1) {
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+int aleft_accept(int listener, char* ip, size_t ipSize) {
+    struct sockaddr_storage their_addr;
+    socklen_t sin_size = sizeof their_addr;
+
+    int new_fd = accept(listener, (struct sockaddr*)&their_addr, &sin_size);
+    if (new_fd == -1)
+        return -1;
+
+    if (ip) {
+        void* addr = their_addr.ss_family == AF_INET
+                   ? (void*) &((struct sockaddr_in*)&their_addr)->sin_addr
+                   : (void*) &((struct sockaddr_in6*)&their_addr)->sin6_addr;
+        if (!inet_ntop(their_addr.ss_family, addr, ip, ipSize) && ipSize > 0)
+            ip[0] = '\0';
+    }
+
+    return new_fd;
+}
+
+int aleft_socket(const char* ip, const char* port, struct sockaddr_storage* address, socklen_t* addressLen) {
+    struct addrinfo hints, *info;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(ip, port, &hints, &info) != 0)
+        return -1;
+
+    int sockfd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (sockfd != -1) {
+        memcpy(address, info->ai_addr, info->ai_addrlen);
+        *addressLen = info->ai_addrlen;
+    }
+
+    freeaddrinfo(info);
+
+    return sockfd;
+}
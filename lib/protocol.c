@@ -0,0 +1,344 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This library is a part of the ALEFT Project.
+ *       It implements the ALEFT protocol, so that files can be
+ *       sent and received from any program, not only from the
+ *       sender and receiver executables.
+ * */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aleft.h"
+
+int aleft_encode_header(char* header, const char* name, long long size) {
+    if (!aleft_check_name(name) || size > ALEFT_MAX_SIZE || size < -1)
+        return -1;
+    size_t nameLen = strlen(name);
+
+    memset(header, 0, ALEFT_FILENAME_LEN);
+    memcpy(header, name, nameLen);
+
+    char sizeStr[32];
+    snprintf(sizeStr, sizeof sizeStr, "%10lld", size);
+    memcpy(header+ALEFT_FILENAME_LEN, sizeStr, ALEFT_FILESIZE_LEN);
+
+    return 0;
+}
+
+bool aleft_check_name(const char* name) {
+    size_t nameLen = strnlen(name, ALEFT_FILENAME_LEN);
+    if (nameLen == 0 || nameLen == ALEFT_FILENAME_LEN)
+        return false;
+
+    // A name, not a path: the file can only be created where the receiver is
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        return false;
+    // Nor one that would replace the receiver's journal or temporary files
+    if (strcmp(name, ALEFT_JOURNAL_NAME) == 0 || strncmp(name, ALEFT_TMP_PREFIX, strlen(ALEFT_TMP_PREFIX)) == 0)
+        return false;
+    for(size_t i = 0; i < nameLen; i++)
+        if (name[i] == '/' || (unsigned char) name[i] < ' ' || name[i] == 0x7f)
+            return false;
+
+    return true;
+}
+
+long long aleft_decode_length(const char* field, size_t len) {
+    size_t i = 0;
+    while (i < len && field[i] == ' ')
+        i++;
+    if (i == len)
+        return -1;
+
+    long long value = 0;
+    for(; i < len; i++) {
+        if (field[i] < '0' || field[i] > '9' || value > (ALEFT_MAX_SIZE - 9) / 10)
+            return -1;
+        value = value*10 + (field[i] - '0');
+    }
+    return value;
+}
+
+bool aleft_decode_checksum(const char* field, unsigned long long* checksum) {
+    unsigned long long value = 0;
+    for(int i = 0; i < ALEFT_CHECKSUM_LEN; i++) {
+        char c = field[i];
+        int digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            return false;
+        value = value << 4 | digit;
+    }
+    *checksum = value;
+    return true;
+}
+
+bool aleft_check_header(const char* header) {
+    const char* fileName = header;
+    const char* fileSizeStr = header+ALEFT_FILENAME_LEN;
+
+    // The name is NUL-padded, with at least one NUL
+    const char* zero = memchr(fileName, '\0', ALEFT_FILENAME_LEN);
+    if (!zero)
+        return false;
+    for(const char* c = zero; c < fileName+ALEFT_FILENAME_LEN; c++)
+        if (*c != '\0')
+            return false;
+    if (!aleft_check_name(fileName))
+        return false;
+
+    if (memcmp(fileSizeStr, ALEFT_STREAM_SIZE, ALEFT_FILESIZE_LEN) == 0)
+        return true;
+
+    return aleft_decode_length(fileSizeStr, ALEFT_FILESIZE_LEN) != -1;
+}
+
+void aleft_decode_header(const char* header, char* name, long long* size) {
+    memcpy(name, header, ALEFT_FILENAME_LEN);
+    name[ALEFT_FILENAME_LEN] = '\0';
+
+    if (memcmp(header+ALEFT_FILENAME_LEN, ALEFT_STREAM_SIZE, ALEFT_FILESIZE_LEN) == 0)
+        *size = -1;
+    else
+        *size = aleft_decode_length(header+ALEFT_FILENAME_LEN, ALEFT_FILESIZE_LEN);
+}
+
+/**
+ * Writes value right-aligned on ALEFT_FILESIZE_LEN Bytes
+ * */
+static void encode_length(char* field, long long value) {
+    char valueStr[32];
+    snprintf(valueStr, sizeof valueStr, "%10lld", value);
+    memcpy(field, valueStr, ALEFT_FILESIZE_LEN);
+}
+
+int aleft_encode_request(char* request, const AleftRange* range) {
+    if (aleft_encode_header(request, range->name, 0) == -1
+        || range->offset < 0 || range->offset > ALEFT_MAX_SIZE
+        || range->length < 0 || range->length > ALEFT_MAX_SIZE)
+        return -1;
+
+    encode_length(request+ALEFT_FILENAME_LEN, range->offset);
+    encode_length(request+ALEFT_FILENAME_LEN+ALEFT_FILESIZE_LEN, range->length);
+    request[ALEFT_REQUEST_LEN-1] = range->checksum ? ALEFT_WANT_CHECKSUM : ' ';
+
+    return 0;
+}
+
+bool aleft_decode_request(const char* request, AleftRange* range) {
+    // The name and the offset make a header
+    if (!aleft_check_header(request))
+        return false;
+    aleft_decode_header(request, range->name, &range->offset);
+
+    range->length = aleft_decode_length(request+ALEFT_FILENAME_LEN+ALEFT_FILESIZE_LEN, ALEFT_FILESIZE_LEN);
+    char wantChecksum = request[ALEFT_REQUEST_LEN-1];
+    range->checksum = wantChecksum == ALEFT_WANT_CHECKSUM;
+
+    return range->offset != -1 && range->length != -1
+        && (wantChecksum == ALEFT_WANT_CHECKSUM || wantChecksum == ' ');
+}
+
+void aleft_encode_reply(char* reply, const AleftReply* answer) {
+    if (answer->fileSize == -1) {
+        memcpy(reply, ALEFT_NO_FILE, ALEFT_FILESIZE_LEN);
+        encode_length(reply+ALEFT_FILESIZE_LEN, 0);
+        encode_length(reply+2*ALEFT_FILESIZE_LEN, 0);
+        return;
+    }
+    encode_length(reply, answer->fileSize);
+    encode_length(reply+ALEFT_FILESIZE_LEN, answer->version);
+    encode_length(reply+2*ALEFT_FILESIZE_LEN, answer->length);
+}
+
+bool aleft_decode_reply(const char* reply, AleftReply* answer) {
+    if (memcmp(reply, ALEFT_NO_FILE, ALEFT_FILESIZE_LEN) == 0)
+        answer->fileSize = -1;
+    else if ((answer->fileSize = aleft_decode_length(reply, ALEFT_FILESIZE_LEN)) == -1)
+        return false;
+
+    answer->version = aleft_decode_length(reply+ALEFT_FILESIZE_LEN, ALEFT_FILESIZE_LEN);
+    answer->length = aleft_decode_length(reply+2*ALEFT_FILESIZE_LEN, ALEFT_FILESIZE_LEN);
+
+    return answer->version != -1 && answer->length != -1;
+}
+
+bool aleft_is_pack(const char* name) {
+    size_t nameLen = strlen(name), suffixLen = strlen(ALEFT_PACK_SUFFIX);
+    return nameLen > suffixLen && strcmp(name + nameLen - suffixLen, ALEFT_PACK_SUFFIX) == 0;
+}
+
+int aleft_encode_pack(char* header, long long count) {
+    if (count < 0 || count > ALEFT_MAX_SIZE)
+        return -1;
+    memcpy(header, ALEFT_PACK_MAGIC, ALEFT_PACK_MAGIC_LEN);
+    encode_length(header+ALEFT_PACK_MAGIC_LEN, count);
+    return 0;
+}
+
+static int by_name(const void* a, const void* b) {
+    return strncmp(*(const char* const*) a, *(const char* const*) b, ALEFT_FILENAME_LEN);
+}
+
+/**
+ * @return true if two of the count HEADERs of index have the same name
+ * */
+static bool has_duplicates(const char* index, long long count) {
+    if (count < 2)
+        return false;
+    const char** names = malloc(count * sizeof *names);
+    if (!names)
+        return true; // can't be told, so not trusted
+    for(long long i = 0; i < count; i++)
+        names[i] = index + i*ALEFT_HEADER_LEN;
+
+    qsort(names, count, sizeof *names, by_name);
+    bool duplicates = false;
+    for(long long i = 1; i < count && !duplicates; i++)
+        duplicates = by_name(&names[i-1], &names[i]) == 0;
+    free(names);
+    return duplicates;
+}
+
+long long aleft_decode_pack(const char* pack, size_t size) {
+    if (size < ALEFT_PACK_HEADER_LEN || memcmp(pack, ALEFT_PACK_MAGIC, ALEFT_PACK_MAGIC_LEN) != 0)
+        return -1;
+    long long count = aleft_decode_length(pack+ALEFT_PACK_MAGIC_LEN, ALEFT_FILESIZE_LEN);
+    if (count == -1 || (unsigned long long) count > (size - ALEFT_PACK_HEADER_LEN) / ALEFT_HEADER_LEN)
+        return -1;
+
+    // What follows the index is exactly the files' contents
+    unsigned long long left = size - ALEFT_PACK_HEADER_LEN - count*ALEFT_HEADER_LEN;
+    const char* entry = pack + ALEFT_PACK_HEADER_LEN;
+    for(long long i = 0; i < count; i++, entry += ALEFT_HEADER_LEN) {
+        if (!aleft_check_header(entry))
+            return -1;
+        long long fileSize = aleft_decode_length(entry+ALEFT_FILENAME_LEN, ALEFT_FILESIZE_LEN);
+        if (fileSize == -1 || (unsigned long long) fileSize > left)
+            return -1;
+        left -= fileSize;
+    }
+
+    // A file would replace another one of the pack
+    if (left != 0 || has_duplicates(pack + ALEFT_PACK_HEADER_LEN, count))
+        return -1;
+    return count;
+}
+
+/*
+ * XXH64, as described in https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+ */
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+static inline unsigned long long rotl64(unsigned long long x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian loads, whatever the host is
+static inline unsigned long long read64(const unsigned char* p) {
+    unsigned long long v = 0;
+    for(int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static inline unsigned long long read32(const unsigned char* p) {
+    return (unsigned long long)p[0] | (unsigned long long)p[1] << 8
+         | (unsigned long long)p[2] << 16 | (unsigned long long)p[3] << 24;
+}
+
+static inline unsigned long long xxh_round(unsigned long long acc, unsigned long long input) {
+    acc += input * XXH_P2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_P1;
+}
+
+static inline unsigned long long xxh_merge(unsigned long long acc, unsigned long long val) {
+    acc ^= xxh_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+static void checksum_stripe(AleftChecksum* checksum, const unsigned char* p) {
+    for(int i = 0; i < 4; i++)
+        checksum->acc[i] = xxh_round(checksum->acc[i], read64(p + 8*i));
+}
+
+void aleft_checksum_init(AleftChecksum* checksum) {
+    checksum->acc[0] = XXH_P1 + XXH_P2;
+    checksum->acc[1] = XXH_P2;
+    checksum->acc[2] = 0;
+    checksum->acc[3] = -XXH_P1;
+    checksum->totalSize = 0;
+    checksum->tailSize = 0;
+}
+
+void aleft_checksum_update(AleftChecksum* checksum, const void* data, size_t size) {
+    const unsigned char* p = (const unsigned char*) data;
+    checksum->totalSize += size;
+
+    // Completing the stripe left by the previous update
+    if (checksum->tailSize > 0) {
+        size_t missing = ALEFT_CHECKSUM_STRIPE - checksum->tailSize;
+        if (size < missing) {
+            memcpy(checksum->tail + checksum->tailSize, p, size);
+            checksum->tailSize += size;
+            return;
+        }
+        memcpy(checksum->tail + checksum->tailSize, p, missing);
+        checksum_stripe(checksum, checksum->tail);
+        p += missing;
+        size -= missing;
+        checksum->tailSize = 0;
+    }
+
+    for(; size >= ALEFT_CHECKSUM_STRIPE; p += ALEFT_CHECKSUM_STRIPE, size -= ALEFT_CHECKSUM_STRIPE)
+        checksum_stripe(checksum, p);
+
+    memcpy(checksum->tail, p, size);
+    checksum->tailSize = size;
+}
+
+unsigned long long aleft_checksum_final(const AleftChecksum* checksum) {
+    unsigned long long hash;
+    if (checksum->totalSize >= ALEFT_CHECKSUM_STRIPE) {
+        const unsigned long long* acc = checksum->acc;
+        hash = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) + rotl64(acc[3], 18);
+        for(int i = 0; i < 4; i++)
+            hash = xxh_merge(hash, acc[i]);
+    } else
+        hash = XXH_P5;
+    hash += checksum->totalSize;
+
+    const unsigned char* p = checksum->tail;
+    size_t size = checksum->tailSize;
+    for(; size >= 8; p += 8, size -= 8)
+        hash = rotl64(hash ^ xxh_round(0, read64(p)), 27) * XXH_P1 + XXH_P4;
+    if (size >= 4) {
+        hash = rotl64(hash ^ (read32(p) * XXH_P1), 23) * XXH_P2 + XXH_P3;
+        p += 4;
+        size -= 4;
+    }
+    for(; size > 0; p++, size--)
+        hash = rotl64(hash ^ (*p * XXH_P5), 11) * XXH_P1;
+
+    hash ^= hash >> 33;
+    hash *= XXH_P2;
+    hash ^= hash >> 29;
+    hash *= XXH_P3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -0,0 +1,1258 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This library is a part of the ALEFT Project.
+ *       It implements the ALEFT protocol, so that files can be
+ *       sent and received from any program, not only from the
+ *       sender and receiver executables.
+ * */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "aleft.h"
+#include "trace.h"
+
+/*
+The file content is received in three ways, tried in this order:
+    - TCP_ZEROCOPY_RECEIVE: the socket's pages are mmap()ed and written
+      to the file from there (only for files of ZEROCOPY_MIN Bytes or more)
+    - splice(): socket -> pipe -> file, without going through user space
+      (only into a regular file)
+    - recv() + write(): the plain copy through the session's buffer
+A method that the kernel does not support is skipped.
+A file received in memory is recv()ed right where it belongs.
+
+Every file is checked against the checksum that follows it: a regular
+file open for reading and writing is read back from the page cache once
+written, anything else is hashed on its way, in user space.
+*/
+#define ZEROCOPY_CHUNK (512*1024)
+#define ZEROCOPY_MIN   (64*1024)
+#define SPLICE_CHUNK   (64*1024)
+
+// How far a relay can be behind the session, in its own pipe
+#define RELAY_PIPE_SIZE (4*SPLICE_CHUNK)
+
+// The beginning of the file sent along with the header
+#define FIRST_BLOCK_SIZE (64*1024)
+
+// How much of a received file is read back at once to be hashed
+#define READ_BACK_CHUNK (1024*1024)
+
+// Returned by the states' functions when the next state can go on
+#define CONTINUE 2
+
+// Returned by the receiving methods, besides the number of Bytes received
+#define RECV_FAILED -1
+#define RECV_WAIT   -2 // nothing to receive yet
+#define RECV_RETRY  -3 // the method gave up, the next one has to be tried
+
+enum {
+    SEND_HEADER,
+    SEND_BODY,
+    SEND_PREFIX,
+    SEND_CHUNK,
+    SEND_TRAILER,
+    RECV_HEADER,
+    RECV_BODY,
+    RECV_PREFIX,
+    RECV_CHUNK,
+    RECV_TRAILER,
+    FINISHED
+};
+
+/**
+ * A socket to which a receive session forwards what it receives.
+ * The spliced Bytes wait in the relay's pipe until its socket takes them,
+ * the Bytes received in user space are sent from where they were received.
+ * */
+typedef struct {
+    int sock;
+    int pipefd[2];                  // the spliced Bytes tee()d for it
+    size_t inPipe;                  // Bytes in pipefd
+    size_t teed;                    // Bytes of the session's pipe already tee()d into pipefd
+    size_t outDone;                 // Bytes of the session's relayOut sent
+    bool failed;
+} Relay;
+
+struct AleftSession {
+    int sock;
+    int state;
+    int status;                     // ALEFT_AGAIN until the session is over
+    short events;                   // what waitFd has to be waited for
+    int waitFd;                     // the session's socket, or a relay's one
+    AleftCallbacks callbacks;
+    AleftStats stats;
+    char error[160];
+
+    char header[ALEFT_HEADER_LEN];
+    size_t headerDone;
+    char name[ALEFT_FILENAME_LEN+1];
+    long long size;                 // -1 for a stream
+    unsigned long long done;        // Bytes of file content sent or received
+
+    int fd;                         // the file, -1 if it's in memory
+    const char* source;             // the file to send, if it's in memory
+    char* sink;                     // the file received in memory
+    size_t sinkCapacity;
+
+    const char* out;                // Bytes of file content waiting to be sent
+    size_t outSize, outDone;
+
+    char* buffer;
+    size_t bufferSize;
+    size_t chunkSize;
+
+    char small[32];                 // block length or checksum being sent or received
+    size_t smallSize, smallDone;
+    unsigned long long chunkLeft;   // Bytes left in the current block of a stream
+
+    AleftChecksum checksum;         // of what has been sent, or received unless it's read back
+    bool readBack;                  // a received file hashed by reading it back once it's written
+    off_t fdStart;                  // where the received file begins in fd
+
+    int pipefd[2];
+    size_t inPipe;                  // Bytes received in the pipe, not spliced into the file yet
+    bool canSplice;
+    bool canZerocopy;
+    void* zcMap;
+    size_t zcSkip;                  // Bytes the kernel can't map, to be copied
+    unsigned long long zcMapped, zcCopied;
+
+    struct sockaddr_storage address; // to connect to with TCP Fast Open
+    socklen_t addressLen;
+
+    Relay relays[ALEFT_MAX_RELAYS];
+    int nbRelays;
+    const char* relayOut;           // Bytes received in user space, to be sent to the relays
+    size_t relayOutSize;
+};
+
+static void set_error(AleftSession* session, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(session->error, sizeof session->error, format, args);
+    va_end(args);
+}
+
+/**
+ * Ends the session in error
+ *
+ * @param format what went wrong, NULL if it's already in session->error
+ * */
+static int fail(AleftSession* session, const char* format, ...) {
+    if (format) {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(session->error, sizeof session->error, format, args);
+        va_end(args);
+    }
+    session->state = FINISHED;
+    session->status = ALEFT_ERROR;
+    if (session->callbacks.on_complete)
+        session->callbacks.on_complete(session, ALEFT_ERROR, session->callbacks.user);
+    return ALEFT_ERROR;
+}
+
+static int finish(AleftSession* session) {
+    session->state = FINISHED;
+    session->status = ALEFT_DONE;
+    if (session->callbacks.on_complete)
+        session->callbacks.on_complete(session, ALEFT_DONE, session->callbacks.user);
+    return ALEFT_DONE;
+}
+
+static int wait_for(AleftSession* session, short events) {
+    session->waitFd = session->sock;
+    session->events = events;
+    return ALEFT_AGAIN;
+}
+
+static void progress(AleftSession* session) {
+    if (session->callbacks.on_progress)
+        session->callbacks.on_progress(session, session->done, session->size, session->callbacks.user);
+}
+
+static int ensure_buffer(AleftSession* session, size_t size) {
+    if (session->bufferSize >= size)
+        return 0;
+    char* buffer = realloc(session->buffer, size);
+    if (!buffer)
+        return -1;
+    session->buffer = buffer;
+    session->bufferSize = size;
+    return 0;
+}
+
+static int write_all(int fd, const char* buffer, size_t size) {
+    while (size > 0) {
+        ssize_t written = TRACE_CALL(write, write(fd, buffer, size));
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buffer += written;
+        size -= written;
+    }
+    return 0;
+}
+
+static size_t min_size(unsigned long long a, unsigned long long b) {
+    return a < b ? a : b;
+}
+
+static AleftSession* session_create(int sock, const AleftCallbacks* callbacks) {
+    AleftSession* session = calloc(1, sizeof *session);
+    if (!session)
+        return NULL;
+
+    session->sock = sock;
+    session->waitFd = sock;
+    session->status = ALEFT_AGAIN;
+    session->fd = -1;
+    session->chunkSize = ALEFT_CHUNK_SIZE;
+    session->pipefd[0] = session->pipefd[1] = -1;
+    session->canSplice = true;
+    if (callbacks)
+        session->callbacks = *callbacks;
+    aleft_checksum_init(&session->checksum);
+
+    int flags = fcntl(sock, F_GETFL);
+    if (flags != -1)
+        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+
+    return session;
+}
+
+AleftSession* aleft_send_fd(int sock, const char* name, int fd, long long size, const AleftCallbacks* callbacks) {
+    AleftSession* session = session_create(sock, callbacks);
+    if (!session)
+        return NULL;
+
+    if (aleft_encode_header(session->header, name, size) == -1) {
+        free(session);
+        return NULL;
+    }
+    strcpy(session->name, name);
+    session->size = size;
+    session->fd = fd;
+    session->state = SEND_HEADER;
+
+    return session;
+}
+
+AleftSession* aleft_send_buffer(int sock, const char* name, const void* data, size_t size, const AleftCallbacks* callbacks) {
+    AleftSession* session = aleft_send_fd(sock, name, -1, size, callbacks);
+    if (session)
+        session->source = data;
+    return session;
+}
+
+AleftSession* aleft_recv(int sock, int fd, const AleftCallbacks* callbacks) {
+    AleftSession* session = session_create(sock, callbacks);
+    if (!session)
+        return NULL;
+
+    session->fd = fd;
+    session->state = RECV_HEADER;
+
+    return session;
+}
+
+void aleft_session_connect(AleftSession* session, const struct sockaddr* address, socklen_t addressLen) {
+    if (addressLen > sizeof session->address)
+        return;
+    memcpy(&session->address, address, addressLen);
+    session->addressLen = addressLen;
+}
+
+int aleft_session_relay(AleftSession* session, int sock) {
+    if (session->state != RECV_HEADER || session->headerDone > 0 || session->nbRelays == ALEFT_MAX_RELAYS)
+        return -1;
+
+    Relay* relay = &session->relays[session->nbRelays];
+    memset(relay, 0, sizeof *relay);
+    relay->sock = sock;
+    if (pipe2(relay->pipefd, O_NONBLOCK) == -1)
+        return -1;
+    fcntl(relay->pipefd[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE);
+
+    int flags = fcntl(sock, F_GETFL);
+    if (flags != -1)
+        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+
+    session->nbRelays++;
+    return 0;
+}
+
+void aleft_session_set_chunk_size(AleftSession* session, size_t chunkSize) {
+    if (chunkSize == 0)
+        chunkSize = 1;
+    if (chunkSize > ALEFT_MAX_CHUNK_SIZE)
+        chunkSize = ALEFT_MAX_CHUNK_SIZE;
+    session->chunkSize = chunkSize;
+}
+
+/*
+ * Sending
+ */
+
+/**
+ * Gets the next Bytes of the file to send, at most max of them
+ *
+ * @return the number of Bytes, 0 at the end of the file, -1 if it can't be read
+ * */
+static ssize_t next_block(AleftSession* session, size_t max) {
+    if (session->source) {
+        session->out = session->source + session->done;
+        session->outSize = max;
+    } else {
+        if (ensure_buffer(session, max) == -1)
+            return -1;
+        ssize_t nbRead;
+        while ((nbRead = TRACE_CALL(read, read(session->fd, session->buffer, max))) == -1 && errno == EINTR);
+        if (nbRead <= 0)
+            return nbRead;
+        session->out = session->buffer;
+        session->outSize = nbRead;
+    }
+    session->outDone = 0;
+    TRACE_BLOCK(hash, session->outSize, aleft_checksum_update(&session->checksum, session->out, session->outSize));
+    return session->outSize;
+}
+
+static int send_header(AleftSession* session) {
+    // The beginning of the file goes with the header, so that a small file fits in one packet
+    if (session->headerDone == 0 && session->outSize == 0 && session->size > 0)
+        if (next_block(session, min_size(FIRST_BLOCK_SIZE, session->size)) == -1)
+            return fail(session, "cannot read the file: %s", strerror(errno));
+
+    while (session->headerDone < ALEFT_HEADER_LEN) {
+        struct iovec iov[2] = {
+            { .iov_base = session->header + session->headerDone, .iov_len = ALEFT_HEADER_LEN - session->headerDone },
+            { .iov_base = (char*) session->out + session->outDone, .iov_len = session->outSize - session->outDone }
+        };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+
+        // TCP Fast Open: connect() and the first send() in one go
+        int flags = MSG_NOSIGNAL;
+        if (session->addressLen) {
+            msg.msg_name = &session->address;
+            msg.msg_namelen = session->addressLen;
+            flags |= MSG_FASTOPEN;
+        }
+
+        ssize_t sent = TRACE_CALL(send, sendmsg(session->sock, &msg, flags));
+        if (sent == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return wait_for(session, POLLOUT);
+            /*
+             * EINPROGRESS: there's no Fast Open cookie yet, the SYN left without data
+             * EOPNOTSUPP: Fast Open is disabled, the usual connect() is needed
+             */
+            if (session->addressLen && (errno == EINPROGRESS || errno == EOPNOTSUPP)) {
+                socklen_t addressLen = session->addressLen;
+                session->addressLen = 0;
+                if (errno == EOPNOTSUPP
+                    && connect(session->sock, (struct sockaddr*) &session->address, addressLen) == -1
+                    && errno != EINPROGRESS)
+                    return fail(session, "cannot connect: %s", strerror(errno));
+                return wait_for(session, POLLOUT);
+            }
+            return fail(session, "cannot send the header: %s", strerror(errno));
+        }
+        session->addressLen = 0;
+
+        size_t headerPart = min_size(sent, ALEFT_HEADER_LEN - session->headerDone);
+        session->headerDone += headerPart;
+        session->outDone += sent - headerPart;
+        session->done += sent - headerPart;
+        session->stats.copiedBytes += sent - headerPart;
+    }
+
+    if (session->done > 0)
+        progress(session);
+
+    session->state = session->size == -1 ? SEND_PREFIX : SEND_BODY;
+    return CONTINUE;
+}
+
+/**
+ * Sends what's left of session->small, then goes to nextState
+ * */
+static int send_small(AleftSession* session, int flags, int nextState) {
+    while (session->smallDone < session->smallSize) {
+        ssize_t sent = TRACE_CALL(send, send(session->sock, session->small + session->smallDone,
+                                             session->smallSize - session->smallDone, flags | MSG_NOSIGNAL));
+        if (sent == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return wait_for(session, POLLOUT);
+            return fail(session, "cannot send: %s", strerror(errno));
+        }
+        session->smallDone += sent;
+    }
+
+    session->smallSize = session->smallDone = 0;
+    if (nextState == FINISHED)
+        return finish(session);
+    session->state = nextState;
+    return CONTINUE;
+}
+
+static int send_body(AleftSession* session) {
+    while (true) {
+        if (session->outDone == session->outSize) {
+            if (session->done == (unsigned long long) session->size) {
+                snprintf(session->small, sizeof session->small, "%016llx", aleft_checksum_final(&session->checksum));
+                session->smallSize = ALEFT_CHECKSUM_LEN;
+                session->state = SEND_TRAILER;
+                return CONTINUE;
+            }
+            ssize_t nbRead = next_block(session, min_size(session->chunkSize, session->size - session->done));
+            if (nbRead == -1)
+                return fail(session, "cannot read the file: %s", strerror(errno));
+            if (nbRead == 0)
+                return fail(session, "the file is shorter than announced");
+        }
+
+        ssize_t sent = TRACE_CALL(send, send(session->sock, session->out + session->outDone,
+                                             session->outSize - session->outDone, MSG_NOSIGNAL));
+        if (sent == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return wait_for(session, POLLOUT);
+            return fail(session, "cannot send the file: %s", strerror(errno));
+        }
+        session->outDone += sent;
+        session->done += sent;
+        session->stats.copiedBytes += sent;
+        progress(session);
+    }
+}
+
+/**
+ * Reads the next block of a stream, and sends its length.
+ *
+ * The blocks are read into the buffer, where they are hashed: the
+ * stream ends with an empty block followed by the checksum of its content.
+ * */
+static int send_prefix(AleftSession* session) {
+    if (session->smallSize == 0) {
+        if (ensure_buffer(session, ALEFT_STREAM_CHUNK) == -1)
+            return fail(session, "not enough memory");
+        ssize_t size = TRACE_CALL(read, read(session->fd, session->buffer, ALEFT_STREAM_CHUNK));
+        if (size == -1) {
+            if (errno == EINTR)
+                return CONTINUE;
+            return fail(session, "cannot read the file: %s", strerror(errno));
+        }
+        session->out = session->buffer;
+        session->outSize = size;
+        session->outDone = 0;
+        TRACE_BLOCK(hash, size, aleft_checksum_update(&session->checksum, session->out, size));
+
+        session->chunkLeft = size;
+        if (size > 0) {
+            snprintf(session->small, sizeof session->small, "%10ld", (long) size);
+            session->smallSize = ALEFT_CHUNKSIZE_LEN;
+        } else {
+            snprintf(session->small, sizeof session->small, "%10d%016llx", 0, aleft_checksum_final(&session->checksum));
+            session->smallSize = ALEFT_CHUNKSIZE_LEN + ALEFT_CHECKSUM_LEN;
+        }
+        session->smallDone = 0;
+    }
+
+    return send_small(session, session->chunkLeft ? MSG_MORE : 0, session->chunkLeft ? SEND_CHUNK : FINISHED);
+}
+
+static int send_chunk(AleftSession* session) {
+    while (session->chunkLeft > 0) {
+        ssize_t sent = TRACE_CALL(send, send(session->sock, session->out + session->outDone, session->chunkLeft, MSG_NOSIGNAL));
+        if (sent == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return wait_for(session, POLLOUT);
+            return fail(session, "cannot send the file: %s", strerror(errno));
+        }
+
+        session->outDone += sent;
+        session->stats.copiedBytes += sent;
+        session->chunkLeft -= sent;
+        session->done += sent;
+        progress(session);
+    }
+
+    session->state = SEND_PREFIX;
+    return CONTINUE;
+}
+
+/*
+ * Receiving
+ */
+
+/**
+ * Stops forwarding to relay
+ * */
+static void drop_relay(AleftSession* session, Relay* relay, const char* error) {
+    relay->failed = true;
+    if (session->callbacks.on_relay_error)
+        session->callbacks.on_relay_error(session, relay->sock, error, session->callbacks.user);
+}
+
+/**
+ * Sends to every relay what it's behind with, as much as its socket takes:
+ * its pipe first, then what's left of session->relayOut
+ * */
+static void relay_flush(AleftSession* session) {
+    for (int i = 0; i < session->nbRelays; i++) {
+        Relay* relay = &session->relays[i];
+        while (!relay->failed && relay->inPipe > 0) {
+            ssize_t sent = TRACE_CALL(relay, splice(relay->pipefd[0], NULL, relay->sock, NULL, relay->inPipe,
+                                                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE));
+            if (sent == -1 && errno == EINTR)
+                continue;
+            if (sent == -1 && errno == EAGAIN)
+                break;
+            if (sent <= 0) {
+                drop_relay(session, relay, sent == 0 ? "disconnected" : strerror(errno));
+                break;
+            }
+            relay->inPipe -= sent;
+            session->stats.relayedBytes += sent;
+        }
+
+        while (!relay->failed && relay->inPipe == 0 && relay->outDone < session->relayOutSize) {
+            ssize_t sent = TRACE_CALL(relay, send(relay->sock, session->relayOut + relay->outDone,
+                                                  session->relayOutSize - relay->outDone, MSG_NOSIGNAL | MSG_DONTWAIT));
+            if (sent == -1 && errno == EINTR)
+                continue;
+            if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (sent <= 0) {
+                drop_relay(session, relay, sent == 0 ? "disconnected" : strerror(errno));
+                break;
+            }
+            relay->outDone += sent;
+            session->stats.relayedBytes += sent;
+        }
+    }
+}
+
+/**
+ * Forwards size Bytes received in user space to every relay.
+ * They have to stay where they are until the relays have caught up.
+ * */
+static void relay_bytes(AleftSession* session, const char* data, size_t size) {
+    if (session->nbRelays == 0)
+        return;
+    session->relayOut = data;
+    session->relayOutSize = size;
+    for (int i = 0; i < session->nbRelays; i++)
+        session->relays[i].outDone = 0;
+    relay_flush(session);
+}
+
+static int wait_for_relay(AleftSession* session, const Relay* relay) {
+    session->waitFd = relay->sock;
+    session->events = POLLOUT;
+    return ALEFT_AGAIN;
+}
+
+/**
+ * Empties the pipe into the file through the buffer,
+ * when the file refuses to be spliced into.
+ * */
+static int drain_pipe(AleftSession* session, size_t size) {
+    if (ensure_buffer(session, session->chunkSize) == -1)
+        return -1;
+    while (size > 0) {
+        ssize_t msgSize = TRACE_CALL(read, read(session->pipefd[0], session->buffer, min_size(size, session->bufferSize)));
+        if (msgSize <= 0) {
+            if (msgSize == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (write_all(session->fd, session->buffer, msgSize) == -1)
+            return -1;
+        session->stats.copiedBytes += msgSize;
+        size -= msgSize;
+    }
+    return 0;
+}
+
+/**
+ * Moves the Bytes of the session's pipe into the file, once every relay has
+ * them in its own pipe. tee() always copies from the beginning of the pipe:
+ * a relay that got only part of them gets the rest once that part has gone
+ * into the file.
+ *
+ * @return 0 once the pipe is empty
+ *         1 if a relay's socket has to be waited for
+ *         -1 if the file can't be written (see session->error)
+ * */
+static int flush_pipe(AleftSession* session) {
+    while (session->inPipe > 0) {
+        size_t ready = session->inPipe; // Bytes that every relay has
+        Relay* late = NULL;
+        for (int i = 0; i < session->nbRelays; i++) {
+            Relay* relay = &session->relays[i];
+            if (relay->failed)
+                continue;
+            if (relay->teed == 0) {
+                ssize_t teed;
+                while ((teed = tee(session->pipefd[0], relay->pipefd[1], session->inPipe, SPLICE_F_NONBLOCK)) == -1
+                       && errno == EINTR);
+                if (teed == -1 && errno != EAGAIN) {
+                    drop_relay(session, relay, strerror(errno));
+                    continue;
+                }
+                if (teed > 0) {
+                    relay->teed = teed;
+                    relay->inPipe += teed;
+                }
+            }
+            if (relay->teed < ready) {
+                ready = relay->teed;
+                late = relay;
+            }
+        }
+
+        // A relay's pipe is full, it needs its socket to take some of it
+        if (ready == 0) {
+            size_t inPipe = late->inPipe;
+            relay_flush(session);
+            if (!late->failed && late->inPipe == inPipe) {
+                wait_for_relay(session, late);
+                return 1;
+            }
+            continue;
+        }
+
+        size_t left = ready;
+        while (left > 0) {
+            ssize_t outPipe = TRACE_CALL(write, splice(session->pipefd[0], NULL, session->fd, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE));
+            if (outPipe == -1 && errno == EINTR)
+                continue;
+            if (outPipe <= 0) {
+                // The file can't be spliced into, what's left in the pipe is copied
+                if (drain_pipe(session, left) == -1) {
+                    set_error(session, "cannot save the file: %s", strerror(errno));
+                    return -1;
+                }
+                session->canSplice = false;
+                break;
+            }
+            session->stats.splicedBytes += outPipe;
+            left -= outPipe;
+        }
+
+        session->inPipe -= ready;
+        for (int i = 0; i < session->nbRelays; i++)
+            if (!session->relays[i].failed)
+                session->relays[i].teed -= ready;
+    }
+    return 0;
+}
+
+/**
+ * Forwards to the relays what they're behind with, without blocking.
+ * Nothing more is received until they have caught up, so a slow relay
+ * slows the session down.
+ *
+ * @param all whether everything has to be forwarded, or only what keeps the
+ *            session from receiving more (the relays' pipes can stay full)
+ *
+ * @return CONTINUE once the relays have caught up
+ *         ALEFT_AGAIN if a relay's socket has to be waited for
+ *         ALEFT_ERROR if the file can't be written
+ * */
+static int relay_catch_up(AleftSession* session, bool all) {
+    if (session->nbRelays == 0)
+        return CONTINUE;
+
+    relay_flush(session);
+    int status = flush_pipe(session);
+    if (status == -1)
+        return fail(session, NULL);
+    if (status == 1)
+        return ALEFT_AGAIN;
+
+    for (int i = 0; i < session->nbRelays; i++) {
+        Relay* relay = &session->relays[i];
+        if (!relay->failed && (relay->outDone < session->relayOutSize || (all && relay->inPipe > 0)))
+            return wait_for_relay(session, relay);
+    }
+    return CONTINUE;
+}
+
+/**
+ * Receives what's left of session->small (smallSize Bytes)
+ *
+ * @return CONTINUE once they're all there
+ * */
+static int recv_small(AleftSession* session) {
+    while (session->smallDone < session->smallSize) {
+        int status = relay_catch_up(session, false);
+        if (status != CONTINUE)
+            return status;
+
+        ssize_t msgSize = TRACE_CALL(recv, recv(session->sock, session->small + session->smallDone,
+                                                session->smallSize - session->smallDone, 0));
+        if (msgSize == 0)
+            return fail(session, "the sender has disconnected");
+        if (msgSize == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return wait_for(session, POLLIN);
+            return fail(session, "cannot receive: %s", strerror(errno));
+        }
+        relay_bytes(session, session->small + session->smallDone, msgSize);
+        session->smallDone += msgSize;
+    }
+    session->small[session->smallSize] = '\0';
+    return CONTINUE;
+}
+
+static ssize_t recv_status(AleftSession* session, ssize_t msgSize) {
+    if (msgSize >= 0)
+        return msgSize;
+    if (errno == EINTR)
+        return RECV_RETRY;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return RECV_WAIT;
+    set_error(session, "cannot receive: %s", strerror(errno));
+    return RECV_FAILED;
+}
+
+/**
+ * Hashes Bytes as they are written, unless the file is to be read back
+ * */
+static void hash_written(AleftSession* session, const void* data, size_t size) {
+    if (!session->readBack)
+        TRACE_BLOCK(hash, size, aleft_checksum_update(&session->checksum, data, size));
+}
+
+static ssize_t recv_memory(AleftSession* session, unsigned long long limit) {
+    ssize_t msgSize = recv_status(session, TRACE_CALL(recv, recv(session->sock, session->sink + session->done, limit, 0)));
+    if (msgSize > 0) {
+        relay_bytes(session, session->sink + session->done, msgSize);
+        hash_written(session, session->sink + session->done, msgSize);
+        session->stats.copiedBytes += msgSize;
+    }
+    return msgSize;
+}
+
+static ssize_t recv_copy(AleftSession* session, unsigned long long limit) {
+    if (ensure_buffer(session, session->chunkSize) == -1) {
+        set_error(session, "not enough memory");
+        return RECV_FAILED;
+    }
+
+    ssize_t msgSize = recv_status(session, TRACE_CALL(recv, recv(session->sock, session->buffer,
+                                                                 min_size(limit, session->chunkSize), 0)));
+    if (msgSize <= 0)
+        return msgSize;
+
+    relay_bytes(session, session->buffer, msgSize);
+    if (write_all(session->fd, session->buffer, msgSize) == -1) {
+        set_error(session, "cannot save the file: %s", strerror(errno));
+        return RECV_FAILED;
+    }
+    hash_written(session, session->buffer, msgSize);
+    session->stats.copiedBytes += msgSize;
+    return msgSize;
+}
+
+static ssize_t recv_splice(AleftSession* session, unsigned long long limit) {
+    if (session->pipefd[0] == -1) {
+        if (pipe(session->pipefd) == -1) {
+            session->canSplice = false;
+            return RECV_RETRY;
+        }
+        fcntl(session->pipefd[1], F_SETPIPE_SZ, SPLICE_CHUNK);
+    }
+
+    ssize_t inPipe = TRACE_CALL(recv, splice(session->sock, NULL, session->pipefd[1], NULL, min_size(limit, SPLICE_CHUNK),
+                                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE));
+    if (inPipe == -1 && session->stats.splicedBytes == 0 && (errno == EINVAL || errno == ENOSYS)) {
+        session->canSplice = false;
+        return RECV_RETRY;
+    }
+    if (inPipe <= 0)
+        return recv_status(session, inPipe);
+
+    // With relays, some of it may stay in the pipe until they have caught up
+    session->inPipe = inPipe;
+    if (flush_pipe(session) == -1)
+        return RECV_FAILED;
+
+    return inPipe;
+}
+
+static void stop_zerocopy(AleftSession* session) {
+    if (session->zcMap)
+        munmap(session->zcMap, ZEROCOPY_CHUNK);
+    session->zcMap = NULL;
+    session->canZerocopy = false;
+}
+
+static ssize_t recv_zerocopy(AleftSession* session, unsigned long long limit) {
+#ifdef TCP_ZEROCOPY_RECEIVE
+    // The payload may never be page aligned (e.g. on loopback), splice() is then a better bet
+    if (session->zcMapped == 0 && session->zcCopied >= ZEROCOPY_MIN) {
+        stop_zerocopy(session);
+        return RECV_RETRY;
+    }
+
+    if (!session->zcMap) {
+        session->zcMap = mmap(NULL, ZEROCOPY_CHUNK, PROT_READ, MAP_SHARED, session->sock, 0);
+        if (session->zcMap == MAP_FAILED) {
+            session->zcMap = NULL;
+            stop_zerocopy(session);
+            return RECV_RETRY;
+        }
+    }
+
+    /*
+     * Only whole pages can be mapped, the kernel tells us through
+     * recv_skip_hint how many Bytes have to be read the usual way
+     * before the next mappable page (unaligned data or the file's tail).
+     */
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    if (session->zcSkip > 0 || limit < pageSize) {
+        ssize_t msgSize = recv_copy(session, session->zcSkip > 0 ? min_size(session->zcSkip, limit) : limit);
+        if (msgSize > 0) {
+            session->zcCopied += msgSize;
+            session->zcSkip -= min_size(session->zcSkip, msgSize);
+        }
+        return msgSize;
+    }
+
+    struct tcp_zerocopy_receive zc;
+    memset(&zc, 0, sizeof zc);
+    zc.address = (uintptr_t) session->zcMap;
+    zc.length = min_size(limit - limit%pageSize, ZEROCOPY_CHUNK);
+    socklen_t zcLen = sizeof zc;
+    int zcStatus;
+    TRACE_BLOCK(recv, zc.length, zcStatus = getsockopt(session->sock, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, &zc, &zcLen));
+    if (zcStatus == -1) {
+        if (errno == EINTR)
+            return RECV_RETRY;
+        if (errno == EIO) // the sender has disconnected
+            return 0;
+        if (session->zcMapped == 0) {
+            stop_zerocopy(session);
+            return RECV_RETRY;
+        }
+        set_error(session, "getsockopt(TCP_ZEROCOPY_RECEIVE): %s", strerror(errno));
+        return RECV_FAILED;
+    }
+
+    if (zc.length > 0) {
+        if (write_all(session->fd, session->zcMap, zc.length) == -1) {
+            set_error(session, "cannot save the file: %s", strerror(errno));
+            return RECV_FAILED;
+        }
+        hash_written(session, session->zcMap, zc.length);
+        madvise(session->zcMap, zc.length, MADV_DONTNEED);
+        session->zcMapped += zc.length;
+        session->stats.mappedBytes += zc.length;
+        session->zcSkip = zc.recv_skip_hint;
+        return zc.length;
+    }
+
+    if (zc.recv_skip_hint > 0) {
+        session->zcSkip = zc.recv_skip_hint;
+        return RECV_RETRY;
+    }
+
+    // Nothing to read yet
+    return RECV_WAIT;
+#else
+    stop_zerocopy(session);
+    return RECV_RETRY;
+#endif
+}
+
+/**
+ * Receives at most limit Bytes of file content, with the best method available
+ *
+ * @return the number of Bytes received, 0 if the sender has disconnected,
+ *         RECV_WAIT if there's nothing to receive yet, RECV_FAILED on error
+ * */
+static ssize_t recv_content(AleftSession* session, unsigned long long limit) {
+    while (true) {
+        ssize_t msgSize;
+        if (session->fd == -1)
+            msgSize = recv_memory(session, limit);
+        else if (session->canZerocopy)
+            msgSize = recv_zerocopy(session, limit);
+        else if (session->canSplice)
+            msgSize = recv_splice(session, limit);
+        else
+            msgSize = recv_copy(session, limit);
+
+        if (msgSize != RECV_RETRY)
+            return msgSize;
+    }
+}
+
+static int recv_header(AleftSession* session) {
+    while (session->headerDone < ALEFT_HEADER_LEN) {
+        int status = relay_catch_up(session, false);
+        if (status != CONTINUE)
+            return status;
+
+        ssize_t msgSize = TRACE_CALL(recv, recv(session->sock, session->header + session->headerDone,
+                                                ALEFT_HEADER_LEN - session->headerDone, 0));
+        if (msgSize == 0)
+            return fail(session, "the sender has disconnected");
+        if (msgSize == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return wait_for(session, POLLIN);
+            return fail(session, "cannot receive the header: %s", strerror(errno));
+        }
+        relay_bytes(session, session->header + session->headerDone, msgSize);
+        session->headerDone += msgSize;
+    }
+
+    if (!aleft_check_header(session->header))
+        return fail(session, "wrong header format");
+    aleft_decode_header(session->header, session->name, &session->size);
+
+    if (session->fd == -1 && session->callbacks.on_header) {
+        int fd = session->callbacks.on_header(session, session->name, session->size, session->callbacks.user);
+        if (fd == ALEFT_REFUSE)
+            return fail(session, "the file has been refused");
+        session->fd = fd;
+    }
+
+    /*
+     * The sink grows as the Bytes come (see grow_sink()), not as the header
+     * announces them. It's allocated here so that an empty file isn't NULL.
+     */
+    if (session->fd == -1) {
+        if (session->callbacks.maxMemory && session->size > (long long) session->callbacks.maxMemory)
+            return fail(session, "the file is too big to be received in memory (%lld Bytes)", session->size);
+        if (!(session->sink = malloc(1)))
+            return fail(session, "not enough memory");
+        session->sinkCapacity = 0;
+    }
+
+    /*
+     * A regular file that can be read is hashed by reading it back once it's
+     * written, whatever moved its Bytes. Anything else (memory, a pipe, a file
+     * opened write-only) is hashed as it's written, so its Bytes can't be
+     * spliced: they go through user space.
+     */
+    if (session->fd != -1) {
+        struct stat st;
+        int flags = fcntl(session->fd, F_GETFL);
+        if (fstat(session->fd, &st) == 0 && S_ISREG(st.st_mode) && flags != -1 && (flags & O_ACCMODE) == O_RDWR) {
+            session->fdStart = flags & O_APPEND ? st.st_size : lseek(session->fd, 0, SEEK_CUR);
+            session->readBack = session->fdStart != -1;
+        }
+    }
+
+    // The mapped pages are given back right away, the relays want them spliced
+    session->canZerocopy = session->fd != -1 && session->size >= ZEROCOPY_MIN && session->nbRelays == 0;
+    session->canSplice = session->readBack;
+
+    if (session->size == -1) {
+        session->smallSize = ALEFT_CHUNKSIZE_LEN;
+        session->state = RECV_PREFIX;
+    } else
+        session->state = RECV_BODY;
+    return CONTINUE;
+}
+
+/**
+ * Makes room in memory for the next Bytes of a file, as they come rather
+ * than as the header or the block announces them, which would let a
+ * sender have any size allocated with a few Bytes. The sink never gets
+ * bigger than the file's size, nor than callbacks.maxMemory.
+ *
+ * @return how many Bytes can be received, 0 if there's no more room
+ *         (the error is set)
+ * */
+static unsigned long long grow_sink(AleftSession* session, unsigned long long wanted) {
+    if (session->done == session->sinkCapacity) {
+        unsigned long long limit = session->size >= 0 ? (unsigned long long) session->size : ALEFT_MAX_SIZE;
+        if (session->callbacks.maxMemory && session->callbacks.maxMemory < limit)
+            limit = session->callbacks.maxMemory;
+        if (session->done >= limit) {
+            set_error(session, "the file is too big to be received in memory (more than %llu Bytes)", limit);
+            return 0;
+        }
+
+        unsigned long long capacity = session->sinkCapacity ? 2*session->sinkCapacity : ALEFT_STREAM_CHUNK;
+        if (capacity > limit)
+            capacity = limit;
+        char* sink = realloc(session->sink, capacity);
+        if (!sink) {
+            set_error(session, "not enough memory");
+            return 0;
+        }
+        session->sink = sink;
+        session->sinkCapacity = capacity;
+    }
+    unsigned long long room = session->sinkCapacity - session->done;
+    return wanted < room ? wanted : room;
+}
+
+static int recv_body(AleftSession* session) {
+    while (session->done < (unsigned long long) session->size) {
+        int status = relay_catch_up(session, false);
+        if (status != CONTINUE)
+            return status;
+
+        unsigned long long limit = session->size - session->done;
+        if (session->fd == -1 && (limit = grow_sink(session, limit)) == 0)
+            return fail(session, NULL);
+
+        ssize_t msgSize = recv_content(session, limit);
+        if (msgSize == RECV_WAIT)
+            return wait_for(session, POLLIN);
+        if (msgSize == RECV_FAILED)
+            return fail(session, NULL);
+        if (msgSize == 0)
+            return fail(session, "transfer is incomplete, only %llu Bytes out of %lld received",
+                        session->done, session->size);
+        session->done += msgSize;
+        progress(session);
+    }
+
+    session->smallSize = ALEFT_CHECKSUM_LEN;
+    session->smallDone = 0;
+    session->state = RECV_TRAILER;
+    return CONTINUE;
+}
+
+static int recv_prefix(AleftSession* session) {
+    int status = recv_small(session);
+    if (status != CONTINUE)
+        return status;
+
+    long long chunkSize = aleft_decode_length(session->small, ALEFT_CHUNKSIZE_LEN);
+    if (chunkSize == -1)
+        return fail(session, "wrong block format");
+    // The stream ends with an empty block, and its checksum
+    if (chunkSize == 0) {
+        session->smallSize = ALEFT_CHECKSUM_LEN;
+        session->smallDone = 0;
+        session->state = RECV_TRAILER;
+        return CONTINUE;
+    }
+
+    session->chunkLeft = chunkSize;
+    session->smallDone = 0;
+    session->state = RECV_CHUNK;
+    return CONTINUE;
+}
+
+static int recv_chunk(AleftSession* session) {
+    while (session->chunkLeft > 0) {
+        int status = relay_catch_up(session, false);
+        if (status != CONTINUE)
+            return status;
+
+        unsigned long long limit = session->chunkLeft;
+        if (session->fd == -1 && (limit = grow_sink(session, limit)) == 0)
+            return fail(session, NULL);
+
+        ssize_t msgSize = recv_content(session, limit);
+        if (msgSize == RECV_WAIT)
+            return wait_for(session, POLLIN);
+        if (msgSize == RECV_FAILED)
+            return fail(session, NULL);
+        if (msgSize == 0)
+            return fail(session, "stream is incomplete, only %llu Bytes received", session->done);
+        session->chunkLeft -= msgSize;
+        session->done += msgSize;
+        progress(session);
+    }
+
+    session->state = RECV_PREFIX;
+    return CONTINUE;
+}
+
+/**
+ * Hashes the file that has just been written, read back from the page cache
+ * with pread() (a file truncated meanwhile makes it fail, not crash)
+ *
+ * @return 0, or -1 if it can't be read back whole (see session->error)
+ * */
+static int read_back(AleftSession* session) {
+    struct stat st;
+    if (fstat(session->fd, &st) == -1) {
+        set_error(session, "cannot check the file: %s", strerror(errno));
+        return -1;
+    }
+    if ((unsigned long long) st.st_size != session->fdStart + session->done) {
+        set_error(session, "the file has %lld Bytes instead of %llu",
+                  (long long) (st.st_size - session->fdStart), session->done);
+        return -1;
+    }
+    if (ensure_buffer(session, READ_BACK_CHUNK) == -1) {
+        set_error(session, "not enough memory");
+        return -1;
+    }
+
+    posix_fadvise(session->fd, session->fdStart, session->done, POSIX_FADV_SEQUENTIAL);
+    for (unsigned long long offset = 0; offset < session->done; ) {
+        ssize_t nbRead = TRACE_CALL(read, pread(session->fd, session->buffer, min_size(READ_BACK_CHUNK, session->done - offset),
+                                                session->fdStart + offset));
+        if (nbRead == -1 && errno == EINTR)
+            continue;
+        if (nbRead <= 0) {
+            set_error(session, "cannot read the file back to check it: %s",
+                      nbRead == 0 ? "it has been truncated" : strerror(errno));
+            return -1;
+        }
+        TRACE_BLOCK(hash, nbRead, aleft_checksum_update(&session->checksum, session->buffer, nbRead));
+        offset += nbRead;
+    }
+    return 0;
+}
+
+/**
+ * Receives the checksum, and compares it to the hash of what has been received
+ * */
+static int recv_trailer(AleftSession* session) {
+    int status = recv_small(session);
+    if (status == CONTINUE)
+        status = relay_catch_up(session, true);
+    if (status != CONTINUE)
+        return status;
+
+    unsigned long long expected;
+    if (!aleft_decode_checksum(session->small, &expected))
+        return fail(session, "wrong checksum format");
+
+    if (session->readBack && read_back(session) == -1)
+        return fail(session, NULL);
+
+    unsigned long long hash = aleft_checksum_final(&session->checksum);
+    if (hash != expected)
+        return fail(session, "the file is corrupted (checksum %016llx instead of %016llx)", hash, expected);
+
+    return finish(session);
+}
+
+int aleft_session_step(AleftSession* session) {
+    while (session->status == ALEFT_AGAIN) {
+        int status;
+        switch (session->state) {
+            case SEND_HEADER:  status = send_header(session); break;
+            case SEND_BODY:    status = send_body(session); break;
+            case SEND_PREFIX:  status = send_prefix(session); break;
+            case SEND_CHUNK:   status = send_chunk(session); break;
+            case SEND_TRAILER: status = send_small(session, 0, FINISHED); break;
+            case RECV_HEADER:  status = recv_header(session); break;
+            case RECV_BODY:    status = recv_body(session); break;
+            case RECV_PREFIX:  status = recv_prefix(session); break;
+            case RECV_CHUNK:   status = recv_chunk(session); break;
+            case RECV_TRAILER: status = recv_trailer(session); break;
+            default:           status = session->status; break;
+        }
+        if (status != CONTINUE)
+            return status;
+    }
+    return session->status;
+}
+
+short aleft_session_events(const AleftSession* session) {
+    return session->events;
+}
+
+int aleft_session_wait_fd(const AleftSession* session) {
+    return session->waitFd;
+}
+
+int aleft_session_run(AleftSession* session) {
+    int status;
+    while ((status = aleft_session_step(session)) == ALEFT_AGAIN) {
+        struct pollfd pfd = { .fd = session->waitFd, .events = session->events };
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            return fail(session, "poll: %s", strerror(errno));
+    }
+    return status;
+}
+
+int aleft_session_socket(const AleftSession* session) {
+    return session->sock;
+}
+
+const char* aleft_session_name(const AleftSession* session) {
+    return session->name;
+}
+
+long long aleft_session_size(const AleftSession* session) {
+    return session->size;
+}
+
+const void* aleft_session_buffer(const AleftSession* session, size_t* size) {
+    if (!session->sink)
+        return NULL;
+    if (size)
+        *size = session->done;
+    return session->sink;
+}
+
+const AleftStats* aleft_session_stats(const AleftSession* session) {
+    return &session->stats;
+}
+
+const char* aleft_session_error(const AleftSession* session) {
+    return session->error;
+}
+
+void aleft_session_free(AleftSession* session) {
+    if (!session)
+        return;
+    if (session->zcMap)
+        munmap(session->zcMap, ZEROCOPY_CHUNK);
+    if (session->pipefd[0] != -1) {
+        close(session->pipefd[0]);
+        close(session->pipefd[1]);
+    }
+    for (int i = 0; i < session->nbRelays; i++) {
+        if (session->relays[i].pipefd[0] != -1) {
+            close(session->relays[i].pipefd[0]);
+            close(session->relays[i].pipefd[1]);
+        }
+    }
+    free(session->buffer);
+    free(session->sink);
+    free(session);
+}
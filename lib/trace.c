@@ -0,0 +1,121 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This library is a part of the ALEFT Project.
+ *       It implements the ALEFT protocol, so that files can be
+ *       sent and received from any program, not only from the
+ *       sender and receiver executables.
+ * */
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#ifdef ALEFT_TRACE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+typedef struct {
+    const char* stage;
+    unsigned long long start;    // ns
+    unsigned long long duration; // ns
+    long long bytes;
+} TraceSpan;
+
+/**
+ * The spans of one thread. Only that thread writes in it,
+ * count being published after the span it counts.
+ * */
+typedef struct TraceRing {
+    struct TraceRing* next;      // the ring of another thread
+    pid_t tid;
+    unsigned long long count;    // spans recorded since the beginning
+    TraceSpan spans[TRACE_RING_SIZE];
+} TraceRing;
+
+// Every thread's ring, pushed without lock
+static TraceRing* rings = NULL;
+static __thread TraceRing* threadRing = NULL;
+static int dumpRegistered = 0;
+
+static void dump_at_exit(void) {
+    const char* path = getenv("ALEFT_TRACE");
+    if (path && *path)
+        aleft_trace_dump(path);
+}
+
+static TraceRing* thread_ring(void) {
+    if (threadRing)
+        return threadRing;
+
+    TraceRing* ring = calloc(1, sizeof *ring);
+    if (!ring)
+        return NULL;
+    ring->tid = syscall(SYS_gettid);
+
+    ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    threadRing = ring;
+
+    if (!__atomic_exchange_n(&dumpRegistered, 1, __ATOMIC_RELAXED))
+        atexit(dump_at_exit);
+
+    return ring;
+}
+
+unsigned long long aleft_trace_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void aleft_trace_record(const char* stage, unsigned long long start, long long bytes) {
+    unsigned long long end = aleft_trace_now();
+    TraceRing* ring = thread_ring();
+    if (!ring)
+        return;
+
+    // The oldest span is overwritten once the ring is full
+    TraceSpan* span = &ring->spans[ring->count % TRACE_RING_SIZE];
+    span->stage = stage;
+    span->start = start;
+    span->duration = end - start;
+    span->bytes = bytes;
+    __atomic_store_n(&ring->count, ring->count + 1, __ATOMIC_RELEASE);
+}
+
+int aleft_trace_dump(const char* path) {
+    FILE* trace = fopen(path, "w");
+    if (!trace)
+        return -1;
+
+    fprintf(trace, "{\"traceEvents\":[");
+    bool first = true;
+    pid_t pid = getpid();
+    for (TraceRing* ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        unsigned long long count = __atomic_load_n(&ring->count, __ATOMIC_ACQUIRE);
+        unsigned long long i = count > TRACE_RING_SIZE ? count - TRACE_RING_SIZE : 0;
+        for (; i < count; i++) {
+            const TraceSpan* span = &ring->spans[i % TRACE_RING_SIZE];
+            fprintf(trace, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"bytes\":%lld}}",
+                    first ? "" : ",", span->stage, span->start / 1000.0, span->duration / 1000.0,
+                    (int) pid, (int) ring->tid, span->bytes);
+            first = false;
+        }
+    }
+    fprintf(trace, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+    return fclose(trace) == 0 ? 0 : -1;
+}
+#else
+int aleft_trace_dump(const char* path) {
+    return -1;
+}
+#endif
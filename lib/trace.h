@@ -0,0 +1,120 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This library is a part of the ALEFT Project.
+ *       It implements the ALEFT protocol, so that files can be
+ *       sent and received from any program, not only from the
+ *       sender and receiver executables.
+ * */
+#ifndef __ALEFT_TRACE__
+#define __ALEFT_TRACE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+The stages of a transfer (read, send, recv, write, hash, relay, progress)
+can be traced, to see where the time goes.
+
+    - Built with ALEFT_TRACE defined (make TRACE=1), every stage is a
+      timestamped span recorded in a ring buffer of its thread, without
+      any lock. If the ALEFT_TRACE environment variable is set, the spans
+      are written in that file when the program exits, in the Chrome trace
+      format (chrome://tracing, https://ui.perfetto.dev).
+      The last TRACE_RING_SIZE spans of each thread are kept.
+
+    - When <sys/sdt.h> is available (and ALEFT_NO_USDT isn't defined),
+      every stage also has two USDT probes, aleft:<stage>__start and
+      aleft:<stage>__done(bytes), which are only nops until a tracer
+      (e.g. bpftrace) attaches to them:
+        bpftrace -e 'usdt:lib/libaleft.so:aleft:recv__done { @[tid] = sum(arg0); }'
+*/
+
+#define TRACE_RING_SIZE 65536
+
+#ifndef ALEFT_NO_USDT
+#  if defined(__has_include)
+#    if __has_include(<sys/sdt.h>)
+#      include <sys/sdt.h>
+#      define ALEFT_USDT
+#    endif
+#  endif
+#endif
+
+/**
+ * Writes the spans of every thread in path, in the Chrome trace format.
+ * Done when the program exits if the ALEFT_TRACE environment variable is set.
+ *
+ * @return 0 if the file has been written, -1 else (or if built without ALEFT_TRACE)
+ */
+int aleft_trace_dump(const char* path);
+
+#ifdef ALEFT_TRACE
+
+/**
+ * @return the current time in ns, from CLOCK_MONOTONIC
+ */
+unsigned long long aleft_trace_now(void);
+
+/**
+ * Records a span of the calling thread, from start to now
+ *
+ * @param stage name of the stage, a string literal
+ * @param bytes Bytes moved during the span (or what the call returned)
+ */
+void aleft_trace_record(const char* stage, unsigned long long start, long long bytes);
+
+#define TRACE_START_() unsigned long long traceStart_ = aleft_trace_now();
+#define TRACE_RECORD_(stage, bytes) aleft_trace_record(#stage, traceStart_, (long long)(bytes));
+#else
+#define TRACE_START_()
+#define TRACE_RECORD_(stage, bytes)
+#endif
+
+#ifdef ALEFT_USDT
+#define TRACE_PROBE_START_(stage) DTRACE_PROBE(aleft, stage##__start);
+#define TRACE_PROBE_DONE_(stage, bytes) DTRACE_PROBE1(aleft, stage##__done, (long long)(bytes));
+#else
+#define TRACE_PROBE_START_(stage)
+#define TRACE_PROBE_DONE_(stage, bytes)
+#endif
+
+/**
+ * TRACE_CALL(stage, expr) evaluates expr as a span of stage,
+ * its value being the number of Bytes (e.g. what read() returns).
+ *
+ * TRACE_BLOCK(stage, bytes, statement) runs statement as a span of stage
+ * which moved bytes Bytes.
+ *
+ * Without tracing nor probes, they're only expr and statement.
+ */
+#if defined(ALEFT_TRACE) || defined(ALEFT_USDT)
+#define TRACE_CALL(stage, expr) __extension__ ({ \
+        TRACE_START_() \
+        TRACE_PROBE_START_(stage) \
+        __typeof__(expr) traceResult_ = (expr); \
+        TRACE_RECORD_(stage, traceResult_) \
+        TRACE_PROBE_DONE_(stage, traceResult_) \
+        traceResult_; })
+#define TRACE_BLOCK(stage, bytes, statement) do { \
+        TRACE_START_() \
+        TRACE_PROBE_START_(stage) \
+        statement; \
+        TRACE_RECORD_(stage, bytes) \
+        TRACE_PROBE_DONE_(stage, bytes) \
+    } while (0)
+#else
+#define TRACE_CALL(stage, expr) (expr)
+#define TRACE_BLOCK(stage, bytes, statement) do { statement; } while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ALEFT_TRACE__
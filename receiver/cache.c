@@ -0,0 +1,216 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This program is a part of the ALEFT Project.
+ *       It's a naive file transfer program, which allows
+ *       two computers to transfer a file to each other.
+ * */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../lib/aleft.h"
+#include "cache.h"
+
+// A block's file name: its key in hexadecimal
+#define BLOCK_NAME_LEN 16
+
+typedef struct {
+    char name[BLOCK_NAME_LEN+1];
+    struct timespec lastUse;
+    off_t size;
+} CachedBlock;
+
+int cache_open(Cache* cache, unsigned long long maxSize) {
+    cache->dir[0] = '\0';
+    cache->maxSize = maxSize;
+    if (maxSize == 0)
+        return EXIT_SUCCESS;
+
+    const char* home = getenv("HOME");
+    if (!home || snprintf(cache->dir, sizeof cache->dir, "%s/%s", home, CACHE_DIR) >= (int) sizeof cache->dir) {
+        cache->dir[0] = '\0';
+        return EXIT_SUCCESS;
+    }
+
+    if (mkdir(cache->dir, 0700) == -1 && errno != EEXIST)
+        cache->dir[0] = '\0';
+
+    return EXIT_SUCCESS;
+}
+
+unsigned long long cache_key(const char* source, const char* fileName,
+                             long long fileSize, long long version, long long block) {
+    char id[512];
+    int idLen = snprintf(id, sizeof id, "%s/%s/%lld/%lld/%lld", source, fileName, fileSize, version, block);
+
+    AleftChecksum checksum;
+    aleft_checksum_init(&checksum);
+    aleft_checksum_update(&checksum, id, idLen < (int) sizeof id ? idLen : (int) sizeof id - 1);
+    return aleft_checksum_final(&checksum);
+}
+
+static void block_path(Cache* cache, unsigned long long key, char* path, size_t size) {
+    snprintf(path, size, "%s/%016llx", cache->dir, key);
+}
+
+static unsigned long long block_checksum(const char* data, size_t size) {
+    AleftChecksum checksum;
+    aleft_checksum_init(&checksum);
+    aleft_checksum_update(&checksum, data, size);
+    return aleft_checksum_final(&checksum);
+}
+
+static bool read_all(int fd, char* data, size_t size, off_t offset) {
+    for (size_t done = 0; done < size;) {
+        ssize_t nbRead = pread(fd, data+done, size-done, offset+done);
+        if (nbRead == -1 && errno == EINTR)
+            continue;
+        if (nbRead <= 0)
+            return false;
+        done += nbRead;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const char* data, size_t size) {
+    for (size_t done = 0; done < size;) {
+        ssize_t nbWritten = write(fd, data+done, size-done);
+        if (nbWritten == -1 && errno == EINTR)
+            continue;
+        if (nbWritten <= 0)
+            return false;
+        done += nbWritten;
+    }
+    return true;
+}
+
+bool cache_get(Cache* cache, unsigned long long key, char* data, size_t size) {
+    if (cache->dir[0] == '\0')
+        return false;
+
+    char path[PATH_MAX+BLOCK_NAME_LEN+2];
+    block_path(cache, key, path, sizeof path);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    char field[ALEFT_CHECKSUM_LEN];
+    unsigned long long expected;
+    bool hit = fstat(fd, &st) == 0 && st.st_size == (off_t) (size + ALEFT_CHECKSUM_LEN)
+            && read_all(fd, data, size, 0) && read_all(fd, field, ALEFT_CHECKSUM_LEN, size)
+            && aleft_decode_checksum(field, &expected) && block_checksum(data, size) == expected;
+
+    // Its modification time tells the block has just been used, and a damaged one is evicted
+    if (hit)
+        futimens(fd, NULL);
+    else
+        unlink(path);
+
+    close(fd);
+    return hit;
+}
+
+void cache_put(Cache* cache, unsigned long long key, const char* data, size_t size) {
+    if (cache->dir[0] == '\0')
+        return;
+
+    // Written aside then renamed, so that a block in the cache is always a whole one
+    char path[PATH_MAX+BLOCK_NAME_LEN+2], tmpPath[PATH_MAX+BLOCK_NAME_LEN+8];
+    block_path(cache, key, path, sizeof path);
+    snprintf(tmpPath, sizeof tmpPath, "%s.%d", path, getpid());
+
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1)
+        return;
+
+    char checksum[ALEFT_CHECKSUM_LEN+1];
+    snprintf(checksum, sizeof checksum, "%016llx", block_checksum(data, size));
+    bool written = write_all(fd, data, size) && write_all(fd, checksum, ALEFT_CHECKSUM_LEN);
+    close(fd);
+
+    if (!written || rename(tmpPath, path) == -1)
+        unlink(tmpPath);
+}
+
+/**
+ * @return true if name is the temporary file of a block, left by a receiver which is gone
+ * */
+static bool is_stale_tmp(const char* name) {
+    if (strlen(name) <= BLOCK_NAME_LEN+1 || name[BLOCK_NAME_LEN] != '.')
+        return false;
+
+    char* end;
+    long pid = strtol(name+BLOCK_NAME_LEN+1, &end, 10);
+    return *end == '\0' && pid > 0 && kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+static int least_recently_used_first(const void* a, const void* b) {
+    const struct timespec* x = &((const CachedBlock*) a)->lastUse;
+    const struct timespec* y = &((const CachedBlock*) b)->lastUse;
+    if (x->tv_sec != y->tv_sec)
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+void cache_trim(Cache* cache) {
+    if (cache->dir[0] == '\0')
+        return;
+
+    DIR* dir = opendir(cache->dir);
+    if (!dir)
+        return;
+
+    CachedBlock* blocks = NULL;
+    size_t nbBlocks = 0, capacity = 0;
+    unsigned long long totalSize = 0;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        if (is_stale_tmp(entry->d_name)) {
+            unlinkat(dirfd(dir), entry->d_name, 0);
+            continue;
+        }
+
+        struct stat st;
+        if (strlen(entry->d_name) != BLOCK_NAME_LEN
+            || fstatat(dirfd(dir), entry->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (nbBlocks == capacity) {
+            capacity = capacity ? capacity*2 : 64;
+            CachedBlock* grown = realloc(blocks, capacity * sizeof *blocks);
+            if (!grown)
+                break;
+            blocks = grown;
+        }
+        strcpy(blocks[nbBlocks].name, entry->d_name);
+        blocks[nbBlocks].lastUse = st.st_mtim;
+        blocks[nbBlocks].size = st.st_size;
+        totalSize += st.st_size;
+        nbBlocks++;
+    }
+
+    if (totalSize > cache->maxSize) {
+        qsort(blocks, nbBlocks, sizeof *blocks, least_recently_used_first);
+        for (size_t i = 0; i < nbBlocks && totalSize > cache->maxSize; i++)
+            if (unlinkat(dirfd(dir), blocks[i].name, 0) == 0)
+                totalSize -= blocks[i].size;
+    }
+
+    free(blocks);
+    closedir(dir);
+}
@@ -0,0 +1,76 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This program is a part of the ALEFT Project.
+ *       It's a naive file transfer program, which allows
+ *       two computers to transfer a file to each other.
+ * */
+#ifndef __CACHE__
+#define __CACHE__
+#include <stdbool.h>
+#include <stddef.h>
+#include <limits.h>
+
+/*
+The blocks fetched in pull mode are kept in a cache, so that reading
+the same ranges again doesn't go through the network.
+
+Each block is a file of CACHE_DIR (in $HOME), named after the hash of
+the sender's address, the file name, the file's size and version, and
+the block's number. A new version of the file thus never hits the
+blocks of the old one. A block is followed by its checksum, and one
+that doesn't match it is removed instead of being used.
+
+A block's modification time is its last use: once the cache is bigger
+than its max size, the least recently used blocks are removed.
+*/
+
+#define CACHE_DIR ".aleft_cache"
+#define CACHE_DEFAULT_SIZE (256ULL*1024*1024)
+
+typedef struct {
+    char dir[PATH_MAX];          // empty if the cache is disabled
+    unsigned long long maxSize;  // in Bytes
+} Cache;
+
+/**
+ * Opens the cache, creating its directory if needed
+ *
+ * @param maxSize max number of Bytes the cache keeps, 0 to disable it
+ *
+ * @return EXIT_SUCCESS, even if the cache is disabled because $HOME isn't usable
+ */
+int cache_open(Cache* cache, unsigned long long maxSize);
+
+/**
+ * @return the key of a block of the file called fileName on the sender source
+ */
+unsigned long long cache_key(const char* source, const char* fileName,
+                             long long fileSize, long long version, long long block);
+
+/**
+ * Reads a block from the cache, which makes it the most recently used one
+ *
+ * @param data where to write the block
+ * @param size size of the block
+ *
+ * @return true if the block was in the cache, and matched its checksum
+ */
+bool cache_get(Cache* cache, unsigned long long key, char* data, size_t size);
+
+/**
+ * Puts a block in the cache
+ */
+void cache_put(Cache* cache, unsigned long long key, const char* data, size_t size);
+
+/**
+ * Removes the least recently used blocks until the cache fits in its max size,
+ * and the blocks left half-written by receivers which are gone
+ */
+void cache_trim(Cache* cache);
+
+#endif // __CACHE__
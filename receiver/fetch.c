@@ -0,0 +1,383 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This program is a part of the ALEFT Project.
+ *       It's a naive file transfer program, which allows
+ *       two computers to transfer a file to each other.
+ * */
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "receiver.h"
+#include "fetch.h"
+#include "../lib/trace.h"
+
+// "host:port" of the sender, in the cache keys
+#define SOURCE_LEN 512
+
+/**
+ * A block of the range
+ * */
+typedef struct {
+    long long number; // in the file
+    char* data;       // NULL until it's fetched
+    size_t size;
+    bool ready;       // true once it's been received and checked
+    bool cached;      // true if it's been found in the cache
+} Block;
+
+/**
+ * A connection to the sender, fetching one block at a time
+ * */
+typedef struct {
+    SOCKET sock;
+    Block* block;     // the block being fetched, NULL if none
+    char reply[ALEFT_REPLY_LEN];
+    size_t replyDone;
+    size_t dataDone;
+    char checksum[ALEFT_CHECKSUM_LEN];
+    size_t checksumDone;
+} Connection;
+
+static int write_all(int fd, const char* buffer, size_t size) {
+    while (size > 0) {
+        ssize_t written = TRACE_CALL(write, write(fd, buffer, size));
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return EXIT_FAILURE;
+        }
+        buffer += written;
+        size -= written;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int send_request(SOCKET sockfd, const char* fileName, long long offset, long long length, bool checksum) {
+    AleftRange range = { .offset = offset, .length = length, .checksum = checksum };
+    strcpy(range.name, fileName);
+
+    char request[ALEFT_REQUEST_LEN];
+    if (aleft_encode_request(request, &range) == -1)
+        return EXIT_FAILURE;
+
+    for (size_t sent = 0; sent < ALEFT_REQUEST_LEN;) {
+        ssize_t msgSize = send(sockfd, request+sent, ALEFT_REQUEST_LEN-sent, MSG_NOSIGNAL);
+        if (msgSize == -1) {
+            if (errno == EINTR)
+                continue;
+            return EXIT_FAILURE;
+        }
+        sent += msgSize;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Asks for the file's size and version, with an empty range
+ * */
+static int ask_info(SOCKET sockfd, const char* fileName, AleftReply* info) {
+    if (send_request(sockfd, fileName, 0, 0, false) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+
+    char reply[ALEFT_REPLY_LEN];
+    for (size_t got = 0; got < ALEFT_REPLY_LEN;) {
+        ssize_t msgSize = TRACE_CALL(recv, recv(sockfd, reply+got, ALEFT_REPLY_LEN-got, 0));
+        if (msgSize <= 0) {
+            if (msgSize == -1 && errno == EINTR)
+                continue;
+            return EXIT_FAILURE;
+        }
+        got += msgSize;
+    }
+
+    return aleft_decode_reply(reply, info) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Receives what the socket has of the connection's block:
+ * the reply, the block itself and its checksum.
+ *
+ * @param info the file's size and version, that every reply must have
+ *
+ * @return EXIT_SUCCESS once the block has been received and checked
+ *         FETCH_AGAIN if the rest hasn't arrived yet
+ *         EXIT_FAILURE if an error has occured
+ */
+static int recv_block(Connection* connection, const AleftReply* info) {
+    Block* block = connection->block;
+
+    while (connection->checksumDone < ALEFT_CHECKSUM_LEN) {
+        char* dst;
+        size_t* done;
+        size_t size;
+        if (connection->replyDone < ALEFT_REPLY_LEN) {
+            dst = connection->reply;
+            done = &connection->replyDone;
+            size = ALEFT_REPLY_LEN;
+        } else if (connection->dataDone < block->size) {
+            dst = block->data;
+            done = &connection->dataDone;
+            size = block->size;
+        } else {
+            dst = connection->checksum;
+            done = &connection->checksumDone;
+            size = ALEFT_CHECKSUM_LEN;
+        }
+
+        ssize_t msgSize = TRACE_CALL(recv, recv(connection->sock, dst + *done, size - *done, MSG_DONTWAIT));
+        if (msgSize == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return FETCH_AGAIN;
+            fprintf(stderr, RED"\nError: "RESET"cannot receive: %s.\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+        if (msgSize == 0) {
+            fprintf(stderr, RED"\nError: "RESET"the sender has disconnected.\n");
+            return EXIT_FAILURE;
+        }
+        *done += msgSize;
+
+        if (dst == connection->reply && connection->replyDone == ALEFT_REPLY_LEN) {
+            AleftReply reply;
+            if (!aleft_decode_reply(connection->reply, &reply)) {
+                fprintf(stderr, RED"\nError: "RESET"wrong reply format.\n");
+                return EXIT_FAILURE;
+            }
+            if (reply.fileSize != info->fileSize || reply.version != info->version
+                || reply.length != (long long) block->size) {
+                fprintf(stderr, RED"\nError: "RESET"the file has changed during the transfer.\n");
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    unsigned long long expected;
+    if (!aleft_decode_checksum(connection->checksum, &expected)) {
+        fprintf(stderr, RED"\nError: "RESET"wrong checksum format.\n");
+        return EXIT_FAILURE;
+    }
+    AleftChecksum checksum;
+    aleft_checksum_init(&checksum);
+    TRACE_BLOCK(hash, block->size, aleft_checksum_update(&checksum, block->data, block->size));
+    if (aleft_checksum_final(&checksum) != expected) {
+        fprintf(stderr, RED"\nError: "RESET"block %lld is corrupted.\n", block->number);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void close_connections(Connection* connections, int nbConnections) {
+    for (int i = 0; i < nbConnections; i++)
+        close(connections[i].sock);
+}
+
+/**
+ * Opens up to request->connections connections to the sender
+ *
+ * @return the number of connections opened
+ * */
+static int open_connections(const FetchRequest* request, Connection* connections) {
+    int nbConnections = 0;
+    for (int i = 0; i < request->connections; i++) {
+        struct sockaddr_storage address;
+        socklen_t addressLen;
+        SOCKET sockfd = aleft_socket(request->host, request->port, &address, &addressLen);
+        if (sockfd == -1)
+            break;
+        if (connect(sockfd, (struct sockaddr*) &address, addressLen) == -1) {
+            close(sockfd);
+            break;
+        }
+        memset(&connections[nbConnections], 0, sizeof *connections);
+        connections[nbConnections++].sock = sockfd;
+    }
+    return nbConnections;
+}
+
+/**
+ * Fetches the blocks of the range, and writes them in order into fd
+ * */
+static int fetch_blocks(const FetchRequest* request, Connection* connections, int nbConnections,
+                        const AleftReply* info, long long start, long long end, int fd, Cache* cache) {
+    long long firstBlock = start / FETCH_BLOCK;
+    long long nbBlocks = end > start ? (end-1) / FETCH_BLOCK - firstBlock + 1 : 0;
+    Block* blocks = calloc(nbBlocks ? nbBlocks : 1, sizeof *blocks);
+    if (!blocks) {
+        fprintf(stderr, RED"\nError: "RESET"not enough memory.\n");
+        return EXIT_FAILURE;
+    }
+
+    char source[SOURCE_LEN];
+    snprintf(source, sizeof source, "%s:%s", request->host, request->port);
+
+    const long long window = (long long) FETCH_WINDOW * nbConnections;
+    long long nextWrite = 0, nextFetch = 0;
+    unsigned long long written = 0, cachedBytes = 0;
+    int status = EXIT_SUCCESS;
+
+    show_progress(0, end-start);
+    while (status == EXIT_SUCCESS && nextWrite < nbBlocks) {
+        // The blocks are written in order, as soon as they're ready
+        if (blocks[nextWrite].ready) {
+            Block* block = &blocks[nextWrite];
+            long long blockStart = block->number * FETCH_BLOCK;
+            long long from = start > blockStart ? start - blockStart : 0;
+            long long to = end < blockStart + (long long) block->size ? end - blockStart : (long long) block->size;
+            if (write_all(fd, block->data + from, to - from) == EXIT_FAILURE) {
+                fprintf(stderr, RED"\nError: "RESET"cannot save the file.\n");
+                status = EXIT_FAILURE;
+                break;
+            }
+            written += to - from;
+            if (block->cached)
+                cachedBytes += to - from;
+            show_progress(written, end-start);
+            free(block->data);
+            block->data = NULL;
+            nextWrite++;
+            continue;
+        }
+
+        // The idle connections are given the next blocks, unless they are in the cache
+        for (int i = 0; i < nbConnections && status == EXIT_SUCCESS; i++) {
+            while (!connections[i].block && nextFetch < nbBlocks && nextFetch < nextWrite + window) {
+                Block* block = &blocks[nextFetch++];
+                block->number = firstBlock + (block - blocks);
+                long long blockStart = block->number * FETCH_BLOCK;
+                block->size = info->fileSize - blockStart < FETCH_BLOCK ? info->fileSize - blockStart : FETCH_BLOCK;
+                if (!(block->data = malloc(block->size ? block->size : 1))) {
+                    fprintf(stderr, RED"\nError: "RESET"not enough memory.\n");
+                    status = EXIT_FAILURE;
+                    break;
+                }
+
+                unsigned long long key = cache_key(source, request->fileName, info->fileSize, info->version, block->number);
+                if (cache_get(cache, key, block->data, block->size)) {
+                    block->ready = block->cached = true;
+                    continue;
+                }
+
+                if (send_request(connections[i].sock, request->fileName, blockStart, block->size, true) == EXIT_FAILURE) {
+                    fprintf(stderr, RED"\nError: "RESET"cannot send the request.\n");
+                    status = EXIT_FAILURE;
+                    break;
+                }
+                Connection* connection = &connections[i];
+                connection->block = block;
+                connection->replyDone = connection->dataDone = connection->checksumDone = 0;
+            }
+        }
+        if (status == EXIT_FAILURE || blocks[nextWrite].ready)
+            continue;
+
+        // Waiting for the connections that are fetching
+        struct pollfd fds[FETCH_MAX_CONNECTIONS];
+        for (int i = 0; i < nbConnections; i++) {
+            fds[i].fd = connections[i].block ? connections[i].sock : -1;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds, nbConnections, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        for (int i = 0; i < nbConnections && status == EXIT_SUCCESS; i++) {
+            if (!fds[i].revents)
+                continue;
+            Connection* connection = &connections[i];
+            int received = recv_block(connection, info);
+            if (received == EXIT_SUCCESS) {
+                Block* block = connection->block;
+                block->ready = true;
+                cache_put(cache, cache_key(source, request->fileName, info->fileSize, info->version, block->number),
+                          block->data, block->size);
+                connection->block = NULL;
+            } else if (received == EXIT_FAILURE)
+                status = EXIT_FAILURE;
+        }
+    }
+
+    if (status == EXIT_SUCCESS) {
+        show_progress(written, end-start);
+        printf(GRN" OK!\n"RESET);
+        printf("%llu Bytes fetched, %llu of them from the cache\n", written, cachedBytes);
+    }
+
+    for (long long i = 0; i < nbBlocks; i++)
+        free(blocks[i].data);
+    free(blocks);
+
+    return status;
+}
+
+int fetch(const FetchRequest* request, FILE* output, Journal* journal, Cache* cache) {
+    Connection connections[FETCH_MAX_CONNECTIONS];
+
+    printf("Connecting to %s:%s...", request->host, request->port);
+    fflush(stdout);
+    int nbConnections = open_connections(request, connections);
+    if (nbConnections == 0) {
+        fprintf(stderr, RED"\nError: "RESET"the connection couldn't be made.\n");
+        return EXIT_FAILURE;
+    }
+    printf(GRN"OK!"RESET" (%d connections)\n", nbConnections);
+
+    AleftReply info;
+    if (ask_info(connections[0].sock, request->fileName, &info) == EXIT_FAILURE || info.fileSize == -1) {
+        fprintf(stderr, RED"\nError: "RESET"%s isn't served.\n", request->fileName);
+        close_connections(connections, nbConnections);
+        return EXIT_FAILURE;
+    }
+
+    // The range, within the file
+    long long start = request->offset < 0 ? info.fileSize + request->offset : request->offset;
+    if (start < 0)
+        start = 0;
+    if (start > info.fileSize)
+        start = info.fileSize;
+    long long end = request->length < 0 || request->length > info.fileSize - start
+                  ? info.fileSize : start + request->length;
+
+    TmpFile tmp;
+    int fd;
+    if (output) {
+        if (fflush(output) == EOF) {
+            close_connections(connections, nbConnections);
+            return EXIT_FAILURE;
+        }
+        fd = fileno(output);
+    } else {
+        if (tmpfile_create(journal, &tmp, request->fileName, end-start) == EXIT_FAILURE) {
+            fprintf(stderr, RED"Error:"RESET" cannot create the file.\n");
+            close_connections(connections, nbConnections);
+            return EXIT_FAILURE;
+        }
+        fd = tmp.fd;
+    }
+
+    int status = fetch_blocks(request, connections, nbConnections, &info, start, end, fd, cache);
+
+    if (!output) {
+        if (status == EXIT_SUCCESS)
+            status = tmpfile_commit(journal, &tmp, request->fileName);
+        else
+            tmpfile_discard(journal, &tmp);
+        close(tmp.fd);
+    }
+
+    close_connections(connections, nbConnections);
+    cache_trim(cache);
+
+    return status;
+}
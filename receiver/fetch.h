@@ -0,0 +1,65 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This program is a part of the ALEFT Project.
+ *       It's a naive file transfer program, which allows
+ *       two computers to transfer a file to each other.
+ * */
+#ifndef __FETCH__
+#define __FETCH__
+#include <stdio.h>
+#include "cache.h"
+#include "journal.h"
+
+/*
+In pull mode, the receiver fetches a range of a file from a sender
+serving a directory (see the pull mode in lib/aleft.h).
+
+The range is cut into blocks of FETCH_BLOCK Bytes, aligned on the
+beginning of the file so that the same blocks are cached whatever the
+range asked. The blocks that aren't in the cache are requested in
+parallel through several connections, each one fetching one block at
+a time, and they are written in order. A connection doesn't fetch more
+than FETCH_WINDOW blocks ahead of the one being written, which bounds
+the memory used.
+*/
+
+#define FETCH_BLOCK (1024*1024)
+#define FETCH_DEFAULT_CONNECTIONS 4
+#define FETCH_MAX_CONNECTIONS 16
+#define FETCH_WINDOW 2
+
+// Returned when a block hasn't been completely received yet
+#define FETCH_AGAIN 2
+
+/**
+ * What to fetch, and from where
+ * */
+typedef struct {
+    const char* host;
+    const char* port;
+    const char* fileName;
+    long long offset;   // negative to count from the end of the file
+    long long length;   // -1 to go up to the end of the file
+    int connections;    // number of parallel connections
+} FetchRequest;
+
+/**
+ * Fetches a range of a file
+ *
+ * @param output file in which write the range.
+ *               If NULL, a file named after the requested one is created,
+ *               through a temporary file recorded in journal.
+ * @param journal journal of the current directory, unused if output isn't NULL
+ * @param cache cache of the blocks
+ *
+ * @return EXIT_SUCCESS if the whole range has been fetched
+ *         EXIT_FAILURE if an error has occured
+ */
+int fetch(const FetchRequest* request, FILE* output, Journal* journal, Cache* cache);
+
+#endif // __FETCH__
@@ -0,0 +1,417 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This program is a part of the ALEFT Project.
+ *       It's a naive file transfer program, which allows
+ *       two computers to transfer a file to each other.
+ * */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "journal.h"
+
+// Past this size, the journal is emptied as soon as no transfer is in progress
+#define JOURNAL_MAX_SIZE (1024*1024)
+
+/**
+ * Appends one event to the journal with a single write(),
+ * so that a crash can't leave half of it.
+ * */
+static void journal_record(Journal* journal, const char* line, size_t size) {
+    if (write(journal->fd, line, size) != (ssize_t)size)
+        perror("journal");
+}
+
+/**
+ * @return whether the "B ..." line begin is the one of the temporary file tmpName
+ * */
+static bool began(const char* begin, const char* tmpName) {
+    size_t len = strlen(tmpName);
+    return strncmp(begin+2, tmpName, len) == 0 && begin[2+len] == ' ';
+}
+
+/**
+ * Looks for the transfers that began without ending in the journal's content:
+ * the one in progress, and the received files that were waiting for their batch.
+ * An anonymous file may end with the name it was linked to, so an unknown name
+ * ends the last anonymous one.
+ *
+ * @param interrupted filled with the "B ..." lines of the interrupted transfers
+ *                    (with their '\n' replaced by '\0'), SYNC_MAX_BATCH+1 at most
+ *
+ * @return the number of interrupted transfers
+ * */
+static size_t find_interrupted(char* content, size_t size, char** interrupted) {
+    size_t count = 0;
+    char* line = content;
+    char* end = content+size;
+    while (line < end) {
+        char* eol = memchr(line, '\n', end-line);
+        if (!eol) // the end of an event that the crash didn't let us write
+            break;
+        *eol = '\0';
+        if (line[0] == 'B') {
+            if (count == SYNC_MAX_BATCH+1) // can't be, unless the journal is corrupted
+                memmove(interrupted, interrupted+1, --count * sizeof *interrupted);
+            interrupted[count++] = line;
+        } else if (line[0] == 'E' && count > 0) {
+            size_t i = count;
+            while (i > 0 && !began(interrupted[i-1], line+2))
+                i--;
+            if (i == 0)
+                for (i = count; i > 0 && !began(interrupted[i-1], "-"); i--);
+            if (i > 0) {
+                memmove(interrupted+i-1, interrupted+i, (count-i) * sizeof *interrupted);
+                count--;
+            }
+        }
+        line = eol+1;
+    }
+    return count;
+}
+
+/**
+ * Removes one of our temporary files, or temporary directories with what they hold.
+ * A directory replaced by a pack can have subdirectories, they are removed too.
+ * */
+static void remove_tmp(int dirfd, const char* tmpName) {
+    if (unlinkat(dirfd, tmpName, 0) == 0 || (errno != EISDIR && errno != EPERM))
+        return;
+
+    int fd = openat(dirfd, tmpName, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    DIR* dir = fd == -1 ? NULL : fdopendir(fd);
+    if (!dir) {
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)))
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            remove_tmp(fd, entry->d_name);
+    closedir(dir);
+
+    unlinkat(dirfd, tmpName, AT_REMOVEDIR);
+}
+
+static int commit_batch(Journal* journal);
+
+int journal_open(Journal* journal, unsigned syncEvery) {
+    journal->syncEvery = syncEvery;
+    journal->nbPending = 0;
+    srandom(getpid() ^ time(NULL));
+
+    if ((journal->dirfd = open(".", O_RDONLY | O_DIRECTORY)) == -1) {
+        perror("open(.)");
+        return EXIT_FAILURE;
+    }
+    if ((journal->fd = open(JOURNAL_NAME, O_RDWR | O_CREAT | O_APPEND, 0644)) == -1) {
+        perror("open("JOURNAL_NAME")");
+        close(journal->dirfd);
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    if (fstat(journal->fd, &st) == -1 || st.st_size == 0)
+        return EXIT_SUCCESS;
+
+    char* content = malloc(st.st_size);
+    if (!content || pread(journal->fd, content, st.st_size, 0) != st.st_size) {
+        free(content);
+        fprintf(stderr, "Could not read the journal\n");
+        return EXIT_SUCCESS;
+    }
+
+    // "B <temporary name> <size> <file name>"
+    char* interrupted[SYNC_MAX_BATCH+1];
+    size_t count = find_interrupted(content, st.st_size, interrupted);
+    for (size_t i = 0; i < count; i++) {
+        char tmpName[TMP_NAME_LEN] = {0};
+        char* fileName = NULL;
+        char* space = strchr(interrupted[i]+2, ' ');
+        if (space && space-(interrupted[i]+2) < TMP_NAME_LEN) {
+            memcpy(tmpName, interrupted[i]+2, space-(interrupted[i]+2));
+            fileName = strchr(space+1, ' ');
+        }
+        // Only our own temporary files are removed, an anonymous one has disappeared with the crash
+        if (strncmp(tmpName, TMP_PREFIX, strlen(TMP_PREFIX)) == 0)
+            remove_tmp(journal->dirfd, tmpName);
+        printf("Interrupted transfer of %s discarded\n", fileName ? fileName+1 : "unknown file");
+    }
+    free(content);
+
+    if (ftruncate(journal->fd, 0) == -1)
+        perror("journal");
+
+    return EXIT_SUCCESS;
+}
+
+void journal_close(Journal* journal) {
+    if (journal->nbPending > 0)
+        commit_batch(journal);
+    close(journal->fd);
+    close(journal->dirfd);
+}
+
+int tmpfile_create(Journal* journal, TmpFile* tmp, const char* fileName, long long fileSize) {
+    strcpy(tmp->tmpName, "-");
+    tmp->fd = openat(journal->dirfd, ".", O_TMPFILE | O_RDWR, 0666);
+
+    // The filesystem doesn't know O_TMPFILE, the temporary file needs a name
+    if (tmp->fd == -1) {
+        strcpy(tmp->tmpName, TMP_PREFIX"XXXXXX");
+        if ((tmp->fd = mkstemp(tmp->tmpName)) == -1) {
+            perror("mkstemp()");
+            return EXIT_FAILURE;
+        }
+        // mkstemp() creates it with 0600, fopen() would have given 0666 & ~umask
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(tmp->fd, 0666 & ~mask);
+    }
+
+    char line[TMP_NAME_LEN+FILENAME_MAX+32];
+    int size = snprintf(line, sizeof line, "B %s %lld %s\n", tmp->tmpName, fileSize, fileName);
+    journal_record(journal, line, size);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Records the end of the transfer of tmp
+ * */
+static void tmpfile_end(Journal* journal, TmpFile* tmp) {
+    char line[TMP_NAME_LEN+4];
+    int size = snprintf(line, sizeof line, "E %s\n", tmp->tmpName);
+    journal_record(journal, line, size);
+
+    // The received files waiting for their batch are still in progress
+    struct stat st;
+    if (journal->nbPending == 0 && fstat(journal->fd, &st) == 0 && st.st_size > JOURNAL_MAX_SIZE)
+        if (ftruncate(journal->fd, 0) == -1)
+            perror("journal");
+}
+
+/**
+ * Links the anonymous temporary file to a new temporary name
+ * */
+static int link_tmpfile(Journal* journal, TmpFile* tmp, const char* procPath) {
+    for(int i = 0; i < 100; i++) {
+        char tmpName[TMP_NAME_LEN];
+        snprintf(tmpName, TMP_NAME_LEN, TMP_PREFIX"%06lx", random() & 0xffffff);
+        if (linkat(AT_FDCWD, procPath, journal->dirfd, tmpName, AT_SYMLINK_FOLLOW) == 0) {
+            strcpy(tmp->tmpName, tmpName);
+            return EXIT_SUCCESS;
+        }
+        if (errno != EEXIST)
+            break;
+    }
+    return EXIT_FAILURE;
+}
+
+/**
+ * Gives the temporary file its real name
+ *
+ * @return EXIT_SUCCESS if it has its name
+ *         EXIT_FAILURE if an error has occured, the temporary file is then discarded
+ * */
+static int name_tmpfile(Journal* journal, TmpFile* tmp, const char* fileName) {
+    bool renamed = false;
+    if (tmp->tmpName[0] == '-') {
+        char procPath[32];
+        snprintf(procPath, sizeof procPath, "/proc/self/fd/%d", tmp->fd);
+        if (linkat(AT_FDCWD, procPath, journal->dirfd, fileName, AT_SYMLINK_FOLLOW) == 0)
+            renamed = true;
+        // linkat() can't replace an existing file, rename() can
+        else if (errno != EEXIST || link_tmpfile(journal, tmp, procPath) == EXIT_FAILURE) {
+            perror("linkat()");
+            tmpfile_discard(journal, tmp);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!renamed && renameat(journal->dirfd, tmp->tmpName, journal->dirfd, fileName) == -1) {
+        perror("rename()");
+        tmpfile_discard(journal, tmp);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Syncs the files waiting for their batch, then gives them their names,
+ * so that none of them has its name before its content is on the disk
+ * */
+static int commit_batch(Journal* journal) {
+    int status = EXIT_SUCCESS;
+    bool named[SYNC_MAX_BATCH];
+
+    for (unsigned i = 0; i < journal->nbPending; i++) {
+        PendingFile* pending = &journal->pending[i];
+        named[i] = false;
+        if (fdatasync(pending->tmp.fd) == -1) {
+            perror("fdatasync()");
+            tmpfile_discard(journal, &pending->tmp);
+            status = EXIT_FAILURE;
+        } else if (name_tmpfile(journal, &pending->tmp, pending->fileName) == EXIT_SUCCESS)
+            named[i] = true;
+        else
+            status = EXIT_FAILURE;
+    }
+
+    // One directory sync for the whole batch, before the ends are recorded
+    if (fsync(journal->dirfd) == -1)
+        perror("fsync()");
+
+    for (unsigned i = 0; i < journal->nbPending; i++) {
+        PendingFile* pending = &journal->pending[i];
+        if (named[i])
+            tmpfile_end(journal, &pending->tmp);
+        close(pending->tmp.fd);
+        free(pending->fileName);
+    }
+    journal->nbPending = 0;
+
+    struct stat st;
+    if (fstat(journal->fd, &st) == 0 && st.st_size > JOURNAL_MAX_SIZE)
+        if (ftruncate(journal->fd, 0) == -1)
+            perror("journal");
+
+    return status;
+}
+
+int tmpfile_commit(Journal* journal, TmpFile* tmp, const char* fileName) {
+    if (journal->syncEvery == SYNC_NEVER) {
+        if (name_tmpfile(journal, tmp, fileName) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+        tmpfile_end(journal, tmp);
+        return EXIT_SUCCESS;
+    }
+
+    if (journal->syncEvery == SYNC_EVERY_FILE) {
+        if (fdatasync(tmp->fd) == -1) {
+            perror("fdatasync()");
+            tmpfile_discard(journal, tmp);
+            return EXIT_FAILURE;
+        }
+        if (name_tmpfile(journal, tmp, fileName) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+        if (fsync(journal->dirfd) == -1)
+            perror("fsync()");
+        tmpfile_end(journal, tmp);
+        return EXIT_SUCCESS;
+    }
+
+    // The file waits for the batch with its own descriptor, tmp->fd is closed by the caller
+    PendingFile* pending = &journal->pending[journal->nbPending];
+    pending->tmp = *tmp;
+    pending->tmp.fd = dup(tmp->fd);
+    pending->fileName = strdup(fileName);
+    if (pending->tmp.fd == -1 || !pending->fileName) {
+        perror("commit");
+        if (pending->tmp.fd != -1)
+            close(pending->tmp.fd);
+        free(pending->fileName);
+        tmpfile_discard(journal, tmp);
+        return EXIT_FAILURE;
+    }
+    journal->nbPending++;
+
+    if (journal->nbPending >= journal->syncEvery || journal->nbPending == SYNC_MAX_BATCH)
+        return commit_batch(journal);
+    return EXIT_SUCCESS;
+}
+
+void tmpfile_discard(Journal* journal, TmpFile* tmp) {
+    if (tmp->tmpName[0] != '-')
+        unlinkat(journal->dirfd, tmp->tmpName, 0);
+    tmpfile_end(journal, tmp);
+}
+
+int tmpdir_create(Journal* journal, TmpFile* tmp, const char* dirName, long long size) {
+    tmp->fd = -1;
+    for(int i = 0; i < 100 && tmp->fd == -1; i++) {
+        snprintf(tmp->tmpName, TMP_NAME_LEN, TMP_PREFIX"%06lx", random() & 0xffffff);
+        if (mkdirat(journal->dirfd, tmp->tmpName, 0777) == 0)
+            tmp->fd = openat(journal->dirfd, tmp->tmpName, O_RDONLY | O_DIRECTORY);
+        else if (errno != EEXIST)
+            break;
+    }
+    if (tmp->fd == -1) {
+        perror("mkdir()");
+        return EXIT_FAILURE;
+    }
+
+    char line[TMP_NAME_LEN+FILENAME_MAX+32];
+    int lineSize = snprintf(line, sizeof line, "B %s %lld %s/\n", tmp->tmpName, size, dirName);
+    journal_record(journal, line, lineSize);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Syncs the files of the temporary directory, and the directory itself
+ * */
+static int sync_tmpdir(TmpFile* tmp) {
+    int fd = dup(tmp->fd);
+    DIR* dir = fd == -1 ? NULL : fdopendir(fd);
+    if (!dir) {
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    int status = 0;
+    struct dirent* entry;
+    while (status == 0 && (entry = readdir(dir))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        int fileFd = openat(tmp->fd, entry->d_name, O_RDONLY | O_NOFOLLOW);
+        if (fileFd == -1 || fdatasync(fileFd) == -1)
+            status = -1;
+        if (fileFd != -1)
+            close(fileFd);
+    }
+    closedir(dir);
+
+    return status == 0 ? fsync(tmp->fd) : -1;
+}
+
+int tmpdir_commit(Journal* journal, TmpFile* tmp, const char* dirName) {
+    if (journal->syncEvery != SYNC_NEVER && sync_tmpdir(tmp) == -1) {
+        perror("fdatasync()");
+        tmpdir_discard(journal, tmp);
+        return EXIT_FAILURE;
+    }
+
+    // An existing directory is swapped with the new one, and removed as a temporary one
+    if (renameat2(journal->dirfd, tmp->tmpName, journal->dirfd, dirName, RENAME_NOREPLACE) == -1) {
+        if (errno != EEXIST || renameat2(journal->dirfd, tmp->tmpName, journal->dirfd, dirName, RENAME_EXCHANGE) == -1) {
+            perror("rename()");
+            tmpdir_discard(journal, tmp);
+            return EXIT_FAILURE;
+        }
+        remove_tmp(journal->dirfd, tmp->tmpName);
+    }
+
+    if (journal->syncEvery != SYNC_NEVER && fsync(journal->dirfd) == -1)
+        perror("fsync()");
+
+    tmpfile_end(journal, tmp);
+
+    return EXIT_SUCCESS;
+}
+
+void tmpdir_discard(Journal* journal, TmpFile* tmp) {
+    remove_tmp(journal->dirfd, tmp->tmpName);
+    tmpfile_end(journal, tmp);
+}
@@ -0,0 +1,151 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This program is a part of the ALEFT Project.
+ *       It's a naive file transfer program, which allows
+ *       two computers to transfer a file to each other.
+ * */
+#ifndef __JOURNAL__
+#define __JOURNAL__
+#include <stdbool.h>
+#include <stdio.h>
+#include "../lib/aleft.h"
+
+/*
+A received file is written into a temporary file, which is given
+its real name only once it has been completely received and checked.
+So a file with its real name is always a complete one.
+
+The temporary file is anonymous (O_TMPFILE) when the filesystem allows it,
+and disappears by itself if the receiver crashes. Otherwise it is named
+TMP_PREFIX"XXXXXX".
+
+Every transfer is recorded in an append-only journal, one line per event:
+    "B <temporary name or -> <size> <file name>\n" when it begins
+    "E <temporary name or ->\n"                    when it ends
+When the receiver starts, the transfers that began without ending are
+the ones interrupted by a crash: their temporary files are removed
+and the journal is emptied.
+
+An unpacked pack is a directory, created the same way: its files are
+written in a temporary directory TMP_PREFIX"XXXXXX", which takes the
+pack's name once they all are.
+*/
+
+// A sender can't use these names, aleft_check_name() refuses them
+#define JOURNAL_NAME ALEFT_JOURNAL_NAME
+#define TMP_PREFIX ALEFT_TMP_PREFIX
+#define TMP_NAME_LEN 16
+
+/*
+When the received files are flushed to the disk:
+    SYNC_EVERY_FILE: each file before it's given its name (fdatasync)
+    N > 1:           every N files (at most SYNC_MAX_BATCH), the received
+                     files wait for the batch to be complete, are synced
+                     together, and then all given their names
+    SYNC_NEVER:      left to the kernel, a file may have its name
+                     before its content is on the disk: after a crash
+                     it can be truncated or empty
+A pack's files are synced together before its directory is given its name,
+unless the policy is SYNC_NEVER.
+*/
+#define SYNC_NEVER 0
+#define SYNC_EVERY_FILE 1
+#define SYNC_MAX_BATCH 64
+
+typedef struct {
+    int fd;                          // open for reading and writing, or the directory
+    char tmpName[TMP_NAME_LEN];      // "-" if the file is anonymous
+} TmpFile;
+
+typedef struct {
+    TmpFile tmp;                     // with its own descriptor
+    char* fileName;
+} PendingFile;
+
+typedef struct {
+    int fd;               // the journal's descriptor
+    int dirfd;            // the directory where the files are received
+    unsigned syncEvery;   // SYNC_NEVER, SYNC_EVERY_FILE or N
+    unsigned nbPending;   // received files waiting for the batch to be synced
+    PendingFile pending[SYNC_MAX_BATCH];
+} Journal;
+
+/**
+ * Opens the journal of the current directory, and cleans up
+ * what the interrupted transfers left behind.
+ *
+ * @param journal journal to initialize
+ * @param syncEvery sync policy
+ *
+ * @return EXIT_SUCCESS if the journal is ready
+ *         EXIT_FAILURE if an error has occured
+ */
+int journal_open(Journal* journal, unsigned syncEvery);
+
+/**
+ * Syncs and names the files waiting for their batch, and closes the journal
+ */
+void journal_close(Journal* journal);
+
+/**
+ * Creates the temporary file in which receive fileName,
+ * and records the beginning of the transfer.
+ *
+ * @param fileSize size announced by the sender, -1 for a stream
+ *
+ * @return EXIT_SUCCESS if the temporary file has been created
+ *         EXIT_FAILURE if an error has occured
+ */
+int tmpfile_create(Journal* journal, TmpFile* tmp, const char* fileName, long long fileSize);
+
+/**
+ * Syncs the temporary file according to the policy, and gives it its real
+ * name, replacing any file with that name. With a batch policy, the file
+ * waits for the batch to be complete, and the whole batch is committed.
+ * tmp->fd still has to be closed afterwards.
+ *
+ * @return EXIT_SUCCESS if the file has been committed or is waiting for its batch
+ *         EXIT_FAILURE if an error has occured, the temporary file is then discarded
+ *         (or, when the batch is committed, one of its files couldn't be)
+ */
+int tmpfile_commit(Journal* journal, TmpFile* tmp, const char* fileName);
+
+/**
+ * Removes the temporary file and records the end of the transfer.
+ * tmp->fd still has to be closed afterwards.
+ */
+void tmpfile_discard(Journal* journal, TmpFile* tmp);
+
+/**
+ * Creates the temporary directory in which unpack dirName,
+ * and records the beginning of the transfer.
+ *
+ * @param size size of the pack
+ *
+ * @return EXIT_SUCCESS if the temporary directory has been created
+ *         EXIT_FAILURE if an error has occured
+ */
+int tmpdir_create(Journal* journal, TmpFile* tmp, const char* dirName, long long size);
+
+/**
+ * Syncs the files of the temporary directory unless the policy is SYNC_NEVER,
+ * and gives it its real name, replacing any directory with that name.
+ * tmp->fd still has to be closed afterwards.
+ *
+ * @return EXIT_SUCCESS if the directory has been committed
+ *         EXIT_FAILURE if an error has occured, the temporary directory is then discarded
+ */
+int tmpdir_commit(Journal* journal, TmpFile* tmp, const char* dirName);
+
+/**
+ * Removes the temporary directory and what it holds, and records the end of the transfer.
+ * tmp->fd still has to be closed afterwards.
+ */
+void tmpdir_discard(Journal* journal, TmpFile* tmp);
+
+#endif // __JOURNAL__
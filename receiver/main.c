@@ -12,7 +12,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <netinet/in.h>
 #include "receiver.h"
+#include "fetch.h"
 
 #define PORT_STR_SIZE 5
 
@@ -26,14 +29,62 @@ inline static bool check_port(char* port) {
     return true;
 }
 
-static int parse_arguments(int argc, char** argv, char* port){;
+#define USAGE "%s -p [PORT NUMBER] [-o OUTPUT PATH] [-k] [-s file|never|N] [-f HOST:PORT]...\n" \
+              "       %s -a [SENDER ADDRESS] -p [PORT NUMBER] -g [FILE NAME] [-r OFFSET[:LENGTH]]\n" \
+              "          [-j CONNECTIONS] [-c CACHE SIZE IN MB] [-o OUTPUT PATH] [-s file|never|N]\n"
+
+/**
+ * Parses the range given with -r: "OFFSET[:LENGTH]",
+ * a negative offset counting from the end of the file.
+ * */
+static bool parse_range(const char* range, FetchRequest* request) {
+    char* end;
+    request->offset = strtoll(range, &end, 10);
+    if (end == range)
+        return false;
+    if (*end == '\0')
+        return true;
+    if (*end != ':')
+        return false;
+
+    const char* length = end+1;
+    request->length = strtoll(length, &end, 10);
+    return end != length && *end == '\0' && request->length >= 0;
+}
+
+/**
+ * Adds the child given with -f: "HOST:PORT",
+ * split on the last ':' so that HOST can be an IPv6 address.
+ * */
+static bool parse_child(char* child, Children* children) {
+    char* colon = strrchr(child, ':');
+    if (!colon || colon == child || colon[1] == '\0' || children->count == ALEFT_MAX_RELAYS)
+        return false;
+    *colon = '\0';
+    children->host[children->count] = child;
+    children->port[children->count] = colon+1;
+    children->count++;
+    return true;
+}
+
+// Set when the receiver is asked to stop
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int signum) {
+    stopping = 1;
+}
+
+static int parse_arguments(int argc, char** argv, char* port, char** outputPath,
+                           bool* keepListening, unsigned* syncEvery,
+                           FetchRequest* fetchRequest, unsigned long long* cacheSize,
+                           Children* children){;
 
     if(argc < 3){
-        fprintf(stderr, RED"Error:"RESET" usage: %s -p [PORT NUMBER]\n", argv[0]);
+        fprintf(stderr, RED"Error:"RESET" usage: "USAGE, argv[0], argv[0]);
         return EXIT_FAILURE;
     }
 
-    const char *optstring = ":p";
+    const char *optstring = ":p:o:ks:a:g:r:j:c:f:";
     int value;
 
     while((value = getopt(argc, argv, optstring)) != EOF){
@@ -41,15 +92,88 @@ static int parse_arguments(int argc, char** argv, char* port){;
         switch(value){
 
             case 'p':
-                strcpy(port, argv[optind]);
+                if (strlen(optarg) > PORT_STR_SIZE) {
+                    fprintf(stderr, RED"Error:"RESET" Invalid port number\n");
+                    return EXIT_FAILURE;
+                }
+                strcpy(port, optarg);
+                break;
+
+            case 'o':
+                *outputPath = optarg;
+                break;
+
+            case 'k':
+                *keepListening = true;
+                break;
+
+            case 's':
+                if (strcmp(optarg, "file") == 0)
+                    *syncEvery = SYNC_EVERY_FILE;
+                else if (strcmp(optarg, "never") == 0)
+                    *syncEvery = SYNC_NEVER;
+                else if ((*syncEvery = strtoul(optarg, NULL, 10)) == 0) {
+                    fprintf(stderr, RED"Error:"RESET" Invalid sync policy\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'a':
+                fetchRequest->host = optarg;
+                break;
+
+            case 'g':
+                if (!aleft_check_name(optarg)) {
+                    fprintf(stderr, RED"Error:"RESET" Invalid file name\n");
+                    return EXIT_FAILURE;
+                }
+                fetchRequest->fileName = optarg;
+                break;
+
+            case 'r':
+                if (!parse_range(optarg, fetchRequest)) {
+                    fprintf(stderr, RED"Error:"RESET" Invalid range\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'j':
+                fetchRequest->connections = atoi(optarg);
+                if (fetchRequest->connections < 1 || fetchRequest->connections > FETCH_MAX_CONNECTIONS) {
+                    fprintf(stderr, RED"Error:"RESET" Between 1 and %d connections\n", FETCH_MAX_CONNECTIONS);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'c':
+                *cacheSize = strtoull(optarg, NULL, 10) * 1024*1024;
+                break;
+
+            case 'f':
+                if (!parse_child(optarg, children)) {
+                    fprintf(stderr, RED"Error:"RESET" Invalid child (HOST:PORT, at most %d of them)\n", ALEFT_MAX_RELAYS);
+                    return EXIT_FAILURE;
+                }
                 break;
 
             default:
-                fprintf(stderr, RED"usage:"RESET" %s -p [PORT NUMBER]\n", argv[0]);
+                fprintf(stderr, RED"usage:"RESET" "USAGE, argv[0], argv[0]);
                 return EXIT_FAILURE;
 
         }
     }
+    if (!fetchRequest->host != !fetchRequest->fileName) {
+        fprintf(stderr, RED"Error:"RESET" -a and -g go together\n");
+        return EXIT_FAILURE;
+    }
+    if (*keepListening && (*outputPath || fetchRequest->host)) {
+        fprintf(stderr, RED"Error:"RESET" -k can't be used with -o or -g\n");
+        return EXIT_FAILURE;
+    }
+    if (children->count > 0 && fetchRequest->host) {
+        fprintf(stderr, RED"Error:"RESET" -f can't be used with -g\n");
+        return EXIT_FAILURE;
+    }
     if (!check_port(port)) {
         fprintf(stderr, RED"Error:"RESET" Invalid port number\n");
         return EXIT_FAILURE;
@@ -62,29 +186,113 @@ static int parse_arguments(int argc, char** argv, char* port){;
 int main(int argc, char const *argv[])
 {
     char PORT[PORT_STR_SIZE+1] = {0};
+    char* outputPath = NULL;
+    bool keepListening = false;
+    unsigned syncEvery = SYNC_EVERY_FILE;
+    FetchRequest fetchRequest = { .offset = 0, .length = -1, .connections = FETCH_DEFAULT_CONNECTIONS };
+    unsigned long long cacheSize = CACHE_DEFAULT_SIZE;
+    Children children = { .count = 0 };
+
+    if(parse_arguments(argc, (char**) argv, PORT, &outputPath, &keepListening, &syncEvery,
+                       &fetchRequest, &cacheSize, &children) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+
+    /**
+     * When the file is written on stdout, everything that would have
+     * been printed on stdout goes to stderr instead.
+     * */
+    FILE* output = NULL;
+    if (outputPath && strcmp(outputPath, STDOUT_NAME) == 0) {
+        int outputFd = dup(STDOUT_FILENO);
+        if (outputFd == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1
+            || !(output = fdopen(outputFd, "w"))) {
+            fprintf(stderr, RED"Error:"RESET" Unable to write on stdout\n");
+            return EXIT_FAILURE;
+        }
+    } else if (outputPath && !(output = fopen(outputPath, "w+"))) {
+        fprintf(stderr, RED"Error:"RESET" Unable to open %s\n", outputPath);
+        return EXIT_FAILURE;
+    }
 
-    if(parse_arguments(argc, (char**) argv, PORT) == EXIT_FAILURE)
+    // The files named after their header are received through the journal
+    Journal journal;
+    if (!output && journal_open(&journal, syncEvery) == EXIT_FAILURE) {
+        fprintf(stderr, RED"Error:"RESET" Unable to open the journal\n");
         return EXIT_FAILURE;
+    }
+
+    // Pull mode: the receiver asks the sender for a range of a file
+    if (fetchRequest.host) {
+        fetchRequest.port = PORT;
+        Cache cache;
+        cache_open(&cache, cacheSize);
+
+        int status = fetch(&fetchRequest, output, &journal, &cache);
+        if (status == EXIT_SUCCESS)
+            printf(GRN "Transfer completed successfully.\n" RESET);
+        else
+            printf(RED "\nFailure: " RESET "File not received.\n");
+
+        if (output)
+            fclose(output);
+        else
+            journal_close(&journal);
+        return status;
+    }
+
     SOCKET sockfd;
 
     printf("Creating the receiver socket...");
     fflush(stdout);
-    if ((sockfd = create_socket(PORT)) == -1) {
+    if ((sockfd = aleft_listen(PORT, BACKLOG)) == -1) {
         fprintf(stderr, RED"Error:"RESET" Unable to create the receiver socket\n");
         return EXIT_FAILURE;
     }
     printf(GRN "OK !\n");
 
-    printf("Listening..."RESET"\n");
-    fflush(stdout);
-    SOCKET new_sockfd;
-    if ((new_sockfd = listen_sender(sockfd)) == -1)
-        fprintf(stderr, RED "Error: " RESET "the connection couldn't be made.\n");
-    
-    if (start_transfer(new_sockfd) == EXIT_SUCCESS)
-        printf(GRN "Transfer completed successfully.\n" RESET);
-    else
-        printf(RED "\nFailure: " RESET "File not received.\n");
-
-    return 0;
+    /**
+     * Stopping interrupts accept(), so that the files waiting for
+     * their batch are synced and named before leaving.
+     * */
+    struct sigaction action;
+    memset(&action, 0, sizeof action);
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // A relay that leaves is reported as an error, instead of killing us in splice()
+    signal(SIGPIPE, SIG_IGN);
+
+    // Failed as soon as one transfer has, so that a pipeline can tell
+    int status = EXIT_SUCCESS;
+    do {
+        printf("Listening..."RESET"\n");
+        fflush(stdout);
+        SOCKET new_sockfd;
+        char senderIp[INET6_ADDRSTRLEN];
+        if ((new_sockfd = aleft_accept(sockfd, senderIp, sizeof senderIp)) == -1) {
+            if (!stopping) {
+                fprintf(stderr, RED "Error: " RESET "the connection couldn't be made.\n");
+                status = EXIT_FAILURE;
+            }
+            continue;
+        }
+        printf("New connection from %s\n", senderIp);
+
+        if (start_transfer(new_sockfd, output, &journal, &children) == EXIT_SUCCESS)
+            printf(GRN "Transfer completed successfully.\n" RESET);
+        else {
+            printf(RED "\nFailure: " RESET "File not received.\n");
+            status = EXIT_FAILURE;
+        }
+    } while (keepListening && !stopping);
+
+    close(sockfd);
+    if (output) {
+        if (fclose(output) == EOF)
+            status = EXIT_FAILURE;
+    } else
+        journal_close(&journal);
+
+    return status;
 }
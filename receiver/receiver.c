@@ -1,192 +1,34 @@
 /**
  * ALEFT PROJECT
- * 
+ *
  * @author Alexandre E.
  * @author Lev M.
  * @date August 2020
- * 
+ *
  * @note This program is a part of the ALEFT Project.
  *       It's a naive file transfer program, which allows
  *       two computers to transfer a file to each other.
  * */
-
 #include "receiver.h"
+#include "unpack.h"
+#include "../lib/trace.h"
 
-void* get_in_addr(struct sockaddr* sa) {
-    if (sa->sa_family == AF_INET)
-        return &(((struct sockaddr_in*)sa)->sin_addr);
-    
-    return &(((struct sockaddr_in6*)sa)->sin6_addr);
-}
-
-SOCKET create_socket(const char* PORT) {
-    SOCKET sockfd;
-    struct addrinfo hints, *rcvInfo, *p;
-    int rv;
-
-    // Initialize the socket
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC; // IPv4 or IPv6
-    hints.ai_socktype = SOCK_STREAM; // SOCK_STREAM (TCP) or SOCK_DGRAM (UDP)
-    hints.ai_flags = AI_PASSIVE; // use my IP
-
-    /**
-     * NULL because we don't connect anywhere, we let the sender connect to us
-     * PORT is the used port
-     * &hints address of the socket initialization parameters
-     * &rcvInfo pointer to the address of the addrinfo struct to initialize with a linked list.
-     * 
-     * rcvInfo will contain a linked list of structs containing
-     * an Internet address that can be specified in a call to bind() or connect().
-     * */
-    if ((rv = getaddrinfo(NULL, PORT, &hints, &rcvInfo)) != 0){
-        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
-        return -1;
-    }
-
-    for (p = rcvInfo; p != NULL; p = p->ai_next) {
-        /**
-         * Creates the socket file descriptor thanks to the current node
-         * */
-        if ((sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
-            perror("socket()");
-            continue;
-        }
-
-        /**
-         * Allows to lose the boring "Address already in use" error message
-         * by specifying the OS that this program is allowed to reuse the port
-         * */
-        int yaaas = 1;
-        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yaaas, sizeof(int)) == -1) {
-            perror("setsockopt()");
-            return -1;
-        }
-
-        /**
-         * Binds the socket to one of the computer's ports, so the kernel can match an incoming
-         * packet to a certain process' socket descriptor.
-         * */
-        if (bind(sockfd, p->ai_addr, p->ai_addrlen) == -1) {
-            close(sockfd);
-            perror("bind()");
-            continue;
-        }
-
-        break;
-    }
-
-    freeaddrinfo(rcvInfo);
-
-    if (!p)
-        return -1;
-
-    return sockfd;
-}
-
-SOCKET listen_sender(SOCKET sockfd) {
-    SOCKET new_fd;
-    struct sockaddr_storage their_addr;
-
-    if (listen(sockfd, 1) == -1) {
-        perror("listen");
-        return -1;
-    }
-
-    socklen_t sin_size = sizeof their_addr;
-    new_fd = accept(sockfd, (struct sockaddr*)&their_addr, &sin_size);
-    if (new_fd == -1) {
-        fprintf(stderr, "Could not accept()\n");
-        return -1;
-    }
-
-    char ip[INET_ADDRSTRLEN];
-    inet_ntop(their_addr.ss_family,
-                get_in_addr((struct sockaddr*)&their_addr),
-                ip,  INET_ADDRSTRLEN*sizeof(char));
-    printf("New connection from %s\n", ip);
-
-    return new_fd;
-}
-
-char* recvHeader(SOCKET sockfd, size_t* headerSize) {
-    const size_t HEADER_LEN = FILENAME_LEN + FILESIZE_LEN;
-
-    size_t recvBytesNb = 0;
-
-    char* header = NULL;
-    char buffer[BUF_SIZE];
-
-    /*
-     * The file header can arrive in several pieces smaller than HEADER_LEN
-     * Bytes. So we have to fill a buffer with every part until
-     * the whole header has arrived.
-     * Part of the beginning of the file may also be received with the header,
-     * and has to be taken into account.
-     */
-    bool disconnected = false;
-    while (recvBytesNb < HEADER_LEN) {
-        int msgSize = recv(sockfd, buffer, BUF_SIZE, 0);
-        if (msgSize <= 0) {
-            disconnected = true;
-            break;
-        }
-        header = realloc(header, recvBytesNb + msgSize);
-        
-        // Copy of the buffer into the header
-        for(size_t i = recvBytesNb; i < recvBytesNb+msgSize; i++)
-            header[i] = buffer[i-recvBytesNb];
-
-        recvBytesNb += msgSize;
-    }
-
-    if (disconnected) {
-        if (header)
-           free(header);
-        return NULL;
-    }
-    *headerSize = recvBytesNb;
-
-    return header;
-}
-
-void decode_fileName(char* header, char* fileName) {
-    strcpy(fileName, header);
-}
-
-void decode_fileSize(char* header, size_t* size) {
-    char fileSizeStr[FILESIZE_LEN+1];
-    strncpy(fileSizeStr, header+FILENAME_LEN, FILESIZE_LEN);
-    fileSizeStr[FILESIZE_LEN] = 0;
-
-    *size = strtol(fileSizeStr, NULL, 10);
-}
-
-bool check_header(char* filename, char* fileSizeStr) {
-    bool zeroEncountered = false;
-    for(int i = 0; i < FILENAME_LEN; i++) {
-        if (filename[i] == '\0')
-            zeroEncountered = true;
-        if (zeroEncountered)
-            if (filename[i] != '\0')
-                return false;
-    }
-
-    bool numberEncountered = false;
-    for(int i = 0; i < FILESIZE_LEN; i++) {
-        if (fileSizeStr[i] != ' ')
-            numberEncountered = true;
-        if (numberEncountered)
-            if (fileSizeStr[i] < '0' || fileSizeStr[i] > '9')
-                return false;
-    }
-
-    return true;
-}
-
-void show_progress(size_t recvBytesNb, size_t fileSize) {
+/**
+ * Where the file of the current transfer goes
+ * */
+typedef struct {
+    FILE* output;     // the file given with -o, or NULL
+    Journal* journal; // used if output is NULL
+    TmpFile tmp;      // the temporary file, if output is NULL
+    bool created;     // true once tmp has been created
+    bool pack;        // true if the file is a pack, received in memory to be unpacked
+    const Children* children;
+    SOCKET childSockets[ALEFT_MAX_RELAYS]; // -1 for the unreachable children
+    int failedRelays; // the children which stopped getting the file along the way
+} Transfer;
+
+void show_progress(unsigned long long recvBytesNb, long long fileSize) {
     printf("\r");
-    fflush(stdout);
     float recvStr = (float) recvBytesNb, sizeStr = (float) fileSize;
     char unit[3];
     strcpy(unit, "B\0");
@@ -203,99 +45,153 @@ void show_progress(size_t recvBytesNb, size_t fileSize) {
         sizeStr /= 1000000000.0;
         strcpy(unit, "GB\0");
     }
-    printf("Awaiting file...%0.f%% (%.2f/%.2f %s received)", ((float)recvStr/(float)sizeStr)*100.0, recvStr, sizeStr, unit);
+    if (fileSize == -1)
+        printf("Receiving stream...%.2f %s received", recvStr, unit);
+    else
+        printf("Awaiting file...%0.f%% (%.2f/%.2f %s received)", fileSize ? ((float)recvStr/(float)sizeStr)*100.0 : 100.0, recvStr, sizeStr, unit);
     fflush(stdout);
 }
 
-int recvFile(SOCKET sockfd, FILE* file, size_t recvBytesNb, size_t fileSize) {
-    char buffer[BUF_SIZE] = {0};
-    int msgSize = 0;
-
-    printf("Awaiting file...0%% (0/0 B received)");
-    fflush(stdout);
-    bool error = false;
-    while (!error && (msgSize = recv(sockfd, buffer, BUF_SIZE, 0)) != 0) {
-        if (msgSize != -1) {
-            for(size_t i = 0; i < msgSize; i++)
-                if (fprintf(file, "%c", buffer[i]) < 0) {
-                    fprintf(stderr, "\n"RED"Error: "RESET"cannot save the file.\n");
-                    error = true;
-                    break;
-                }
-            recvBytesNb += msgSize;
+/**
+ * Chooses where the announced file goes: the output, memory for
+ * a pack, or a temporary file named after the header once it's complete.
+ * */
+static int on_header(AleftSession* session, const char* fileName, long long fileSize, void* user) {
+    Transfer* transfer = user;
+    printf(GRN"OK!\n"RESET);
 
-            show_progress(recvBytesNb, fileSize);
+    if (transfer->output) {
+        if (fflush(transfer->output) == EOF)
+            return ALEFT_REFUSE;
+        show_progress(0, fileSize);
+        return fileno(transfer->output);
+    }
 
-            if (recvBytesNb >= fileSize)
-                break;
-        }
+    if (aleft_is_pack(fileName) && fileSize >= 0 && fileSize <= ALEFT_PACK_MAX_SIZE) {
+        transfer->pack = true;
+        show_progress(0, fileSize);
+        return -1;
     }
 
-    if (recvBytesNb < fileSize) {
-        fprintf(stderr, RED "\nError: " RESET "Transfer is incomplete, only %lu Bytes out of %lu received.\n", recvBytesNb, fileSize);
-        return EXIT_FAILURE;
+    if (tmpfile_create(transfer->journal, &transfer->tmp, fileName, fileSize) == EXIT_FAILURE) {
+        fprintf(stderr, RED"Error:"RESET" cannot create the file.\n");
+        return ALEFT_REFUSE;
     }
+    transfer->created = true;
+    show_progress(0, fileSize);
+    return transfer->tmp.fd;
+}
 
-    printf(GRN" OK!\n"RESET);
-    return EXIT_SUCCESS;
+static void on_progress(AleftSession* session, unsigned long long done, long long total, void* user) {
+    TRACE_BLOCK(progress, done, show_progress(done, total));
 }
 
-int start_transfer(SOCKET senderSocket) {
-    // Receiving the header first
-    size_t headerSize = 0;
+static void on_relay_error(AleftSession* session, int sock, const char* error, void* user) {
+    Transfer* transfer = user;
+    for (int i = 0; i < transfer->children->count; i++)
+        if (transfer->childSockets[i] == sock) {
+            fprintf(stderr, RED"\nError: "RESET"stopped relaying to %s:%s: %s.\n",
+                    transfer->children->host[i], transfer->children->port[i], error);
+            transfer->failedRelays++;
+        }
+}
 
-    printf("Awaiting header...");
-    char* header = recvHeader(senderSocket, &headerSize);
-    if (!header) {
-        fprintf(stderr, RED"\nError: "RESET"an error has occured during the header transfer.\n");
-        close(senderSocket);
-        return EXIT_FAILURE;
+static SOCKET connect_child(const Children* children, int child) {
+    struct sockaddr_storage address;
+    socklen_t addressLen;
+    SOCKET sock = aleft_socket(children->host[child], children->port[child], &address, &addressLen);
+    if (sock == -1)
+        return -1;
+    if (connect(sock, (struct sockaddr*) &address, addressLen) == -1) {
+        close(sock);
+        return -1;
     }
+    return sock;
+}
 
-    // Checking the header format
-    if (!check_header(header, header+FILENAME_LEN)){
-        fprintf(stderr, RED"\nError: "RESET"wrong header format.\n");
-        free(header);
-        return EXIT_FAILURE;
+int start_transfer(SOCKET senderSocket, FILE* output, Journal* journal, const Children* children) {
+    Transfer transfer = { .output = output, .journal = journal, .created = false, .pack = false,
+                          .children = children, .failedRelays = 0 };
+    AleftCallbacks callbacks = {
+        .on_header = on_header,
+        .on_progress = on_progress,
+        .on_relay_error = on_relay_error,
+        .user = &transfer,
+        .maxMemory = ALEFT_PACK_MAX_SIZE // only a pack is received in memory
+    };
+
+    // The children are connected to first, so that they get the file from its first Byte
+    int relays = 0, unreachable = 0;
+    for (int i = 0; i < children->count; i++) {
+        transfer.childSockets[i] = connect_child(children, i);
+        if (transfer.childSockets[i] == -1) {
+            fprintf(stderr, RED"Error: "RESET"cannot reach %s:%s, the file won't be relayed to it.\n",
+                    children->host[i], children->port[i]);
+            unreachable++;
+        } else
+            relays++;
     }
 
-    // Decoding header
-    char fileName[FILENAME_LEN+1];
-    size_t fileSize;
-    decode_fileName(header, fileName);
-    decode_fileSize(header, &fileSize);
-    printf(GRN"OK!\n"RESET);
+    printf("Awaiting header...");
+    fflush(stdout);
 
-    // Receiving the file
-    FILE* file = fopen(fileName, "w");
-    if (!file) {
-        free(header);
-        fprintf(stderr, RED"Error:"RESET" fopen failed.");
+    AleftSession* session = aleft_recv(senderSocket, -1, &callbacks);
+    if (!session) {
+        fprintf(stderr, RED"\nError: "RESET"not enough memory.\n");
+        close(senderSocket);
+        for (int i = 0; i < children->count; i++)
+            if (transfer.childSockets[i] != -1)
+                close(transfer.childSockets[i]);
         return EXIT_FAILURE;
     }
-    /* *
-     * If headerSize > FILENAME_LEN+FILESIZE_LEN, then it means
-     * that a part of the beginning of the file is contained
-     * inside of header, and has to be put into "rawfile".
-     * */
-    size_t recvBytesNb = 0;
-    if (headerSize > FILENAME_LEN+FILESIZE_LEN) { 
-        recvBytesNb = headerSize-(FILENAME_LEN+FILESIZE_LEN);
-        for(size_t i = 0; i < recvBytesNb; i++) {
-            if (fprintf(file, "%c", header[FILENAME_LEN+FILESIZE_LEN+i]) < 0) {
-                fclose(file);
-                free(header);
-                fprintf(stderr, RED"Error: "RESET"an error has occured during the writing of the file.\n");
-                return EXIT_FAILURE;
-            }
+    for (int i = 0; i < children->count; i++)
+        if (transfer.childSockets[i] != -1 && aleft_session_relay(session, transfer.childSockets[i]) == -1) {
+            fprintf(stderr, RED"Error: "RESET"cannot relay to %s:%s.\n", children->host[i], children->port[i]);
+            close(transfer.childSockets[i]);
+            transfer.childSockets[i] = -1;
+            relays--;
+            unreachable++;
         }
+
+    int status = aleft_session_run(session) == ALEFT_DONE ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (status == EXIT_SUCCESS) {
+        const AleftStats* stats = aleft_session_stats(session);
+        printf(GRN" OK!\n"RESET);
+        printf("%llu Bytes received: %llu copied, %llu spliced, %llu mapped\n",
+               stats->copiedBytes + stats->splicedBytes + stats->mappedBytes,
+               stats->copiedBytes, stats->splicedBytes, stats->mappedBytes);
+        // relayedBytes counts what the failed children got before they failed
+        if (relays - transfer.failedRelays > 0)
+            printf("Relayed to %d receiver(s) (%llu Bytes in all)\n", relays - transfer.failedRelays, stats->relayedBytes);
+        if (transfer.failedRelays + unreachable > 0)
+            fprintf(stderr, RED"Error: "RESET"the file didn't reach %d receiver(s): %d couldn't be reached, %d failed along the way.\n",
+                    transfer.failedRelays + unreachable, unreachable, transfer.failedRelays);
+    } else
+        fprintf(stderr, RED"\nError: "RESET"%s.\n", aleft_session_error(session));
+
+    if (transfer.pack && status == EXIT_SUCCESS) {
+        size_t size;
+        const char* pack = aleft_session_buffer(session, &size);
+        long long count = unpack(journal, aleft_session_name(session), pack, size);
+        if (count == -1)
+            status = EXIT_FAILURE;
+        else
+            printf("%lld files unpacked\n", count);
+    }
+
+    if (transfer.created) {
+        if (status == EXIT_SUCCESS)
+            status = tmpfile_commit(journal, &transfer.tmp, aleft_session_name(session));
+        else
+            tmpfile_discard(journal, &transfer.tmp);
+        close(transfer.tmp.fd);
     }
 
-    // Receiving the file
-    int status = recvFile(senderSocket, file, recvBytesNb, fileSize);
-    fclose(file);
+    aleft_session_free(session);
     close(senderSocket);
-    free(header);
+    for (int i = 0; i < children->count; i++)
+        if (transfer.childSockets[i] != -1)
+            close(transfer.childSockets[i]);
 
     return status;
 }
@@ -0,0 +1,80 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This program is a part of the ALEFT Project.
+ *       It's a naive file transfer program, which allows
+ *       two computers to transfer a file to each other.
+ * */
+#include <errno.h>
+#include <fcntl.h>
+#include "receiver.h"
+#include "unpack.h"
+#include "../lib/trace.h"
+
+/**
+ * Creates name in dirfd with size Bytes of content
+ * */
+static int create_file(int dirfd, const char* name, const char* content, long long size) {
+    int fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd == -1)
+        return EXIT_FAILURE;
+
+    while (size > 0) {
+        ssize_t written = TRACE_CALL(write, write(fd, content, size));
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        content += written;
+        size -= written;
+    }
+
+    return close(fd) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+long long unpack(Journal* journal, const char* packName, const char* pack, size_t size) {
+    long long count = aleft_decode_pack(pack, size);
+    if (count == -1) {
+        fprintf(stderr, RED"Error: "RESET"%s isn't a valid pack.\n", packName);
+        return -1;
+    }
+
+    char dirName[FILENAME_LEN+1];
+    size_t dirNameLen = strlen(packName) - strlen(ALEFT_PACK_SUFFIX);
+    memcpy(dirName, packName, dirNameLen);
+    dirName[dirNameLen] = '\0';
+    if (!aleft_check_name(dirName)) {
+        fprintf(stderr, RED"Error: "RESET"%s can't be unpacked in %s.\n", packName, dirName);
+        return -1;
+    }
+
+    TmpFile dir;
+    if (tmpdir_create(journal, &dir, dirName, size) == EXIT_FAILURE)
+        return -1;
+
+    // The index, then the contents in the same order
+    const char* entry = pack + ALEFT_PACK_HEADER_LEN;
+    const char* content = entry + count*ALEFT_HEADER_LEN;
+    for (long long i = 0; i < count; i++, entry += ALEFT_HEADER_LEN) {
+        char name[FILENAME_LEN+1];
+        long long fileSize;
+        aleft_decode_header(entry, name, &fileSize);
+        if (create_file(dir.fd, name, content, fileSize) == EXIT_FAILURE) {
+            fprintf(stderr, RED"Error: "RESET"cannot create %s/%s: %s.\n", dirName, name, strerror(errno));
+            tmpdir_discard(journal, &dir);
+            close(dir.fd);
+            return -1;
+        }
+        content += fileSize;
+    }
+
+    int status = tmpdir_commit(journal, &dir, dirName);
+    close(dir.fd);
+    return status == EXIT_SUCCESS ? count : -1;
+}
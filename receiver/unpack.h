@@ -0,0 +1,35 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This program is a part of the ALEFT Project.
+ *       It's a naive file transfer program, which allows
+ *       two computers to transfer a file to each other.
+ * */
+#ifndef __UNPACK__
+#define __UNPACK__
+#include <stddef.h>
+#include "journal.h"
+
+/*
+A pack (see lib/aleft.h) is received in memory, in one buffer, and
+unpacked from there: its files are written straight from the buffer,
+without any allocation per file, all of them created relative to the
+same temporary directory, which is synced once for the whole pack.
+*/
+
+/**
+ * Creates the directory named after the pack (without ALEFT_PACK_SUFFIX)
+ * with the files it holds, through a temporary directory recorded in journal.
+ *
+ * @param packName name of the pack
+ * @param pack the pack's content, checked before anything is created
+ *
+ * @return the number of files unpacked, or -1 if an error has occured
+ */
+long long unpack(Journal* journal, const char* packName, const char* pack, size_t size);
+
+#endif // __UNPACK__
@@ -0,0 +1,66 @@
+/**
+ * ALEFT PROJECT
+ * 
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ * 
+ * @note This program is a part of the ALEFT Project.
+ *       It's a naive file transfert program, which allows
+ *       two users to transfer a file to each other.
+ * 
+ * */
+#include <signal.h>
+#include "sender.h"
+
+int main(int argc, char* argv[])
+{
+
+    struct sockaddr_storage address;
+    socklen_t addressLen;
+    File* f = NULL;
+    char ip[IP_LEN] = {0};
+    char port[PORT_LEN] = {0};
+
+    bool autoTune = false;
+    char* serveDir = NULL;
+
+    int args = parse_arguments(argc, argv, &f, ip, port, &autoTune, &serveDir);
+    if(args == ERROR){
+        return EXIT_FAILURE;
+    }
+
+    if(serveDir != NULL){
+        signal(SIGPIPE, SIG_IGN);
+        return serve(port, serveDir) == ERROR ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // a receiver that leaves is reported as an error, instead of killing us in splice()
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "Creating socket...");
+    SOCKET sock = aleft_socket(ip, port, &address, &addressLen);
+    if(sock == ERROR){
+        fprintf(stderr, "an error occurred while creating the socket!\n");
+        return EXIT_FAILURE;
+    }
+    printf("OK!\n");
+
+    // a learned send buffer size is set from the start, while probing the tuner changes it during the transfer
+    char destination[DESTINATION_LEN];
+    snprintf(destination, DESTINATION_LEN, "%s:%s", ip, port);
+    Tuner tuner;
+    tuner_init(&tuner, destination, autoTune, ALEFT_CHUNK_SIZE);
+    tuner_apply(&tuner, sock);
+
+    fprintf(stderr, "Sending %s to %s through the port %s...\n", f->name, ip, port);
+    if(send_file(sock, &address, addressLen, f, &tuner) == ERROR){
+        fprintf(stderr, "an error occurred while sending the message!\n");
+        return EXIT_FAILURE;
+    }
+
+    stop_connection(sock);
+    free_file(f);
+    
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pack.h"
+#include "../lib/trace.h"
+
+#define ERROR -1
+#define SUCCESS 0
+
+typedef struct{
+
+    char name[ALEFT_FILENAME_LEN+1];
+    long long size;
+
+}Entry;
+
+
+/*
+* lists the regular files of the directory, with their sizes
+*
+* @return the number of files, or -1 on error
+*/
+static long long list_files(int dirfd, Entry** entries, unsigned long long* contentSize){
+
+    int listfd = dup(dirfd);
+    DIR* dir = listfd == ERROR ? NULL : fdopendir(listfd);
+    if(dir == NULL){
+        if(listfd != ERROR) close(listfd);
+        return ERROR;
+    }
+
+    long long count = 0, capacity = 0;
+    *entries = NULL;
+    *contentSize = 0;
+
+    struct dirent* dirent;
+    while((dirent = readdir(dir)) != NULL){
+
+        // what readdir() already tells isn't asked again
+        if(dirent->d_type != DT_REG && dirent->d_type != DT_UNKNOWN) continue;
+
+        struct statx st;
+        if(statx(dirfd, dirent->d_name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, STATX_TYPE | STATX_SIZE, &st) == ERROR
+           || !S_ISREG(st.stx_mode)) continue;
+
+        // a directory received before keeps the receiver's journal, which isn't sent
+        if(strcmp(dirent->d_name, ALEFT_JOURNAL_NAME) == 0 || strncmp(dirent->d_name, ALEFT_TMP_PREFIX, strlen(ALEFT_TMP_PREFIX)) == 0) continue;
+
+        if(!aleft_check_name(dirent->d_name)){
+            fprintf(stderr, "error: \"%s\" can't be a file name!\n", dirent->d_name);
+            break;
+        }
+
+        // the index takes room in the pack too
+        *contentSize += st.stx_size;
+        if(ALEFT_PACK_HEADER_LEN + (count+1) * ALEFT_HEADER_LEN + *contentSize > ALEFT_PACK_MAX_SIZE){
+            fprintf(stderr, "error: the directory is too big to be packed (more than %lld bytes)!\n", ALEFT_PACK_MAX_SIZE);
+            break;
+        }
+
+        if(count == capacity){
+            capacity = capacity ? capacity*2 : PACK_INITIAL_FILES;
+            Entry* grown = realloc(*entries, capacity * sizeof(Entry));
+            if(grown == NULL) break;
+            *entries = grown;
+        }
+        strcpy((*entries)[count].name, dirent->d_name);
+        (*entries)[count].size = st.stx_size;
+        count++;
+    }
+
+    bool complete = dirent == NULL;
+    closedir(dir);
+
+    if(!complete){
+        free(*entries);
+        *entries = NULL;
+        return ERROR;
+    }
+    return count;
+}
+
+
+/*
+* reads the file of entry in dst, which has room for exactly its size
+*/
+static int read_file(int dirfd, const Entry* entry, char* dst){
+
+    int fd = openat(dirfd, entry->name, O_RDONLY | O_NOFOLLOW);
+    if(fd == ERROR){
+        fprintf(stderr, "error: unable to open \"%s\"\n", entry->name);
+        return ERROR;
+    }
+
+    long long done = 0;
+    while(done < entry->size){
+        ssize_t nbRead = TRACE_CALL(read, read(fd, dst + done, entry->size - done));
+        if(nbRead == ERROR && errno == EINTR) continue;
+        if(nbRead <= 0) break;
+        done += nbRead;
+    }
+    close(fd);
+
+    if(done < entry->size){
+        fprintf(stderr, "error: \"%s\" has changed while being packed!\n", entry->name);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+
+int pack_directory(const char* directory, Pack* pack){
+
+    pack->data = NULL;
+    pack->size = 0;
+    pack->count = 0;
+
+    int dirfd = open(directory, O_RDONLY | O_DIRECTORY);
+    if(dirfd == ERROR){
+        fprintf(stderr, "error: unable to open \"%s\"\n", directory);
+        return ERROR;
+    }
+
+    Entry* entries;
+    unsigned long long contentSize;
+    long long count = list_files(dirfd, &entries, &contentSize);
+    if(count == ERROR){
+        close(dirfd);
+        return ERROR;
+    }
+
+    size_t indexSize = ALEFT_PACK_HEADER_LEN + count * ALEFT_HEADER_LEN;
+    pack->size = indexSize + contentSize;
+    pack->data = malloc(pack->size);
+    if(pack->data == NULL){
+        fprintf(stderr, "error: not enough memory to pack \"%s\"\n", directory);
+        free(entries);
+        close(dirfd);
+        return ERROR;
+    }
+
+    aleft_encode_pack(pack->data, count);
+    char* entry = pack->data + ALEFT_PACK_HEADER_LEN;
+    char* content = pack->data + indexSize;
+    int status = SUCCESS;
+    for(long long i = 0; i < count && status == SUCCESS; i++){
+        aleft_encode_header(entry, entries[i].name, entries[i].size);
+        status = read_file(dirfd, &entries[i], content);
+        entry += ALEFT_HEADER_LEN;
+        content += entries[i].size;
+    }
+
+    free(entries);
+    close(dirfd);
+
+    if(status == ERROR){
+        free_pack(pack);
+        return ERROR;
+    }
+    pack->count = count;
+    return SUCCESS;
+}
+
+
+void free_pack(Pack* pack){
+
+    free(pack->data);
+    pack->data = NULL;
+    pack->size = 0;
+    pack->count = 0;
+}
+
+
+void fix_name(char* name){
+
+    // the trailing slashes of a directory are not part of its name
+    size_t stringSize = strlen(name);
+    while(stringSize > 1 && name[stringSize-1] == '/')
+        name[--stringSize] = '\0';
+
+    const char* lastSlash = strrchr(name, '/');
+    if(lastSlash != NULL && lastSlash[1] != '\0')
+        memmove(name, lastSlash+1, strlen(lastSlash+1)+1);
+}
+
+
+int pack_name(const char* directory, char* name){
+
+    // named after the directory the path leads to: "sub/.." is the parent of sub, "." the cwd
+    char* path = realpath(directory, NULL);
+    if(path == NULL) return ERROR;
+    fix_name(path);
+
+    // the name is checked without the suffix, which would make "..aleftpack" a valid one
+    if(!aleft_check_name(path) || strlen(path) + strlen(ALEFT_PACK_SUFFIX) >= ALEFT_FILENAME_LEN){
+        free(path);
+        return ERROR;
+    }
+    memset(name, 0, ALEFT_FILENAME_LEN);
+    strcpy(name, path);
+    strcat(name, ALEFT_PACK_SUFFIX);
+    free(path);
+
+    return SUCCESS;
+}
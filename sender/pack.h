@@ -0,0 +1,59 @@
+#ifndef __PACK__
+#define __PACK__
+
+#include <stddef.h>
+
+#include "../lib/aleft.h"
+
+/*
+* in pack mode, the regular files of a directory are sent all at once as
+* one pack (see lib/aleft.h), instead of one connection and one header per file.
+*
+* the sizes of all the files are read first with statx(), so that the pack
+* is built in a single buffer of the right size: its header, its index, then
+* each file read straight at its place through one openat() relative to the
+* directory.
+*/
+
+// the initial capacity of the list of files, doubled when needed
+#define PACK_INITIAL_FILES 256
+
+typedef struct{
+
+    char* data; // the whole pack, as sent
+    size_t size;
+    long long count; // the number of files in it
+
+}Pack;
+
+/*
+* packs the regular files of directory (neither its subdirectories
+* nor its symbolic links)
+*
+* @return  0 if everything went well
+* @return -1 else
+*/
+int pack_directory(const char* directory, Pack* pack);
+
+/*
+* frees the pack's buffer
+*/
+void free_pack(Pack* pack);
+
+/*
+* fixes a file name that is actually a path (example : /home/user/test.txt becomes test.txt)
+*/
+void fix_name(char* name);
+
+/*
+* names the pack of directory after the directory its path resolves to
+* ("photos/.", "photos/sub/.." and "photos/" all give photos.aleftpack)
+*
+* @param name ALEFT_FILENAME_LEN Bytes
+*
+* @return  0 if everything went well
+* @return -1 if the path can't be resolved or the directory can't be a file name ("/")
+*/
+int pack_name(const char* directory, char* name);
+
+#endif
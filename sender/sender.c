@@ -10,61 +10,14 @@
  *       two users to transfer a file to each other.
  * 
  * */
-
 #include "sender.h"
 
-int main(int argc, char* argv[])
-{
-
-    SOCKADDR_IN sin;
-    File* f;
-    char ip[16];
-    char port[16];
-
-    int args = parse_arguments(argc, argv, &f, ip, port);
-    if(args == ERROR){
-        return EXIT_FAILURE;
-    }
-
-    SOCKET sock = create_socket(AF_INET, SOCK_STREAM, 0, &sin, ip, port);
-    if(sock == ERROR){
-        fprintf(stderr, "an error occurred while creating the socket!\n");
-        return EXIT_FAILURE;
-    }
-
-    int connection = start_connection(sock, sin);
-    if(connection == ERROR){
-        fprintf(stderr, "an error occurred while starting the connection!\n");
-        return EXIT_FAILURE;
-    }
-
-    int header = send_header(sock, f);
-    if(header == ERROR){
-        fprintf(stderr, "an error occurred while sending the header!\n");
-        return EXIT_FAILURE;
-    }
-    int message = send_message(sock, f);
-    if(message == ERROR){
-        fprintf(stderr, "an error occurred while sending the message!\n");
-        return EXIT_FAILURE;
-    }
-
-    stop_connection(sock);
-    free_file(f);
-    
-    return EXIT_SUCCESS;
-}
-
-int parse_arguments(int argc, char** argv, File** f, char* ip, char* port){
+int parse_arguments(int argc, char** argv, File** f, char* ip, char* port, bool* autoTune, char** serveDir){
 
     assert(f != NULL);
 
-    if(argc < NB_ARGS-1){
-        fprintf(stderr, "usage : ./server -i [filename.extension] -a [ip] -p [port]\n");
-        return ERROR;
-    }
-
-    const char *optstring = ":i:a:p:";
+    const char *optstring = ":i:a:p:n:ts:";
+    char* name = NULL;
     int value;
 
     while((value = getopt(argc, argv, optstring)) != EOF){
@@ -72,43 +25,108 @@ int parse_arguments(int argc, char** argv, File** f, char* ip, char* port){
         switch(value){
 
             case 'i':
-                (*f) = open_file(argv[optind-1]);
-                if(f == NULL) return ERROR;
+                if(*f != NULL) free_file(*f);
+                (*f) = open_file(optarg);
+                if(*f == NULL) return ERROR;
             break;
 
             case 'a':
-                strcpy((ip), argv[optind-1]);
+                if(strlen(optarg) >= IP_LEN){
+                    fprintf(stderr, "error: address is too long!\n");
+                    return ERROR;
+                }
+                strcpy(ip, optarg);
             break;
 
             case 'p':
-                strcpy((port), argv[optind-1]);
+                if(strlen(optarg) >= PORT_LEN){
+                    fprintf(stderr, "error: port is too long!\n");
+                    return ERROR;
+                }
+                strcpy(port, optarg);
+            break;
+
+            case 'n':
+                name = optarg;
+            break;
+
+            case 't':
+                *autoTune = true;
+            break;
+
+            case 's':
+                *serveDir = optarg;
             break;
 
             default:
-                fprintf(stderr, "usage : ./server -i [filename.extension] -a [ip] -p [port]\n");
+                fprintf(stderr, USAGE);
                 return ERROR;
 
         }
     }
 
-    return SUCCESS;
-}
-
+    if(*serveDir != NULL && port[0] != '\0') return SUCCESS;
 
-unsigned long get_file_size(char* filename){
+    if(*f == NULL || ip[0] == '\0' || port[0] == '\0'){
+        fprintf(stderr, USAGE);
+        return ERROR;
+    }
 
-    assert(filename != NULL);
+    if(name != NULL){
+        if(!aleft_check_name(name)){
+            fprintf(stderr, "error: \"%s\" can't be a file name!\n", name);
+            return ERROR;
+        }
+        memset((*f)->name, 0, FILENAME_LEN);
+        strcpy((*f)->name, name);
 
-    struct stat st;
+        // a pack has to keep its suffix to be unpacked
+        if((*f)->pack != NULL && !aleft_is_pack(name)){
+            if(strlen(name) + strlen(ALEFT_PACK_SUFFIX) >= FILENAME_LEN){
+                fprintf(stderr, "error: \"%s\" is too long a name!\n", name);
+                return ERROR;
+            }
+            strcat((*f)->name, ALEFT_PACK_SUFFIX);
+        }
+    }
 
-    stat(filename, &st);
-    return st.st_size;
+    return SUCCESS;
 }
 
+
 File* create_file(){
 
     File* f = malloc(sizeof(File));
     if(f == NULL) return NULL;
+    f->pack = NULL;
+    return f;
+}
+
+/*
+* packs the files of the directory called "dirname" in f
+*/
+static File* open_pack(File* f, char* dirname){
+
+    fprintf(stderr, "Packing directory...");
+
+    f->pack = malloc(sizeof(Pack));
+    if(f->pack == NULL || pack_directory(dirname, f->pack) == ERROR){
+        free(f->pack);
+        free(f);
+        return NULL;
+    }
+    f->file = NULL;
+    f->stream = false;
+    f->size = f->pack->size;
+
+    if(pack_name(dirname, f->name) == ERROR){
+        fprintf(stderr, "error: \"%s\" can't be the name of a pack!\n", dirname);
+        free_file(f);
+        return NULL;
+    }
+
+    printf("OK! (%lld files, %lld bytes)\n", f->pack->count, f->size);
+
     return f;
 }
 
@@ -125,106 +143,104 @@ File* open_file(char* filename){
         return NULL;
     }
 
-    f->file = fopen(filename, "r");
+    memset(f->name, 0, FILENAME_LEN);
+
+    struct stat path;
+    if(strcmp(filename, STDIN_NAME) != 0 && stat(filename, &path) == 0 && S_ISDIR(path.st_mode))
+        return open_pack(f, filename);
+
+    if(strcmp(filename, STDIN_NAME) == 0){
+        f->file = stdin;
+        strcpy(f->name, "stdin");
+    }
+    else
+        f->file = fopen(filename, "r");
 
     if(f->file == NULL){
         fprintf(stderr, "error: unable to open \"%s\"\n", filename);
+        free(f);
         return NULL;
     }
 
-    if(get_file_size(filename) > MAX_SIZE){
-        fprintf(stderr, "error: file is too big!\n");
+    struct stat st;
+    if(fstat(fileno(f->file), &st) == ERROR){
+        fprintf(stderr, "error: unable to stat \"%s\"\n", filename);
+        free_file(f);
         return NULL;
     }
 
-    sprintf(f->size, "%10lu", get_file_size(filename));
-
-    if(strchr(filename, '/') != NULL)
-        fix_name(filename);
-
-    strcpy(f->name, filename);
-
-    printf("OK!\n");
-
-    return f;
-}
-
-SOCKET create_socket(int domain, int type, int protocol, SOCKADDR_IN* sin, char* ip, char* port){
-
-    fprintf(stderr, "Creating socket...");
+    // pipes, sockets and terminals have no size: their content is streamed
+    f->stream = !S_ISREG(st.st_mode);
 
-    assert(sin != NULL && ip != NULL && port != NULL);
+    f->size = f->stream ? -1 : st.st_size;
+    if(f->size > ALEFT_MAX_SIZE){
+        fprintf(stderr, "error: file is too big!\n");
+        free_file(f);
+        return NULL;
+    }
 
-    SOCKET sock = socket(domain, type, protocol); 
-    if(sock == ERROR) return ERROR; 
+    if(f->file != stdin){
+        if(strchr(filename, '/') != NULL)
+            fix_name(filename);
 
-    sin->sin_addr.s_addr = inet_addr(ip);
-    sin->sin_family = domain;
-    sin->sin_port = htons(atoi(port));
+        if(!aleft_check_name(filename)){
+            fprintf(stderr, "error: \"%s\" can't be a file name, give one with -n!\n", filename);
+            free_file(f);
+            return NULL;
+        }
+        strcpy(f->name, filename);
+    }
 
     printf("OK!\n");
 
-    return sock;
+    return f;
 }
 
+/*
+* shows how much has been sent, and lets the tuner measure the throughput
+*/
+static void on_progress(AleftSession* session, unsigned long long done, long long total, void* user){
 
-int send_header(SOCKET sock, File* file){
+    Tuner* tuner = user;
 
-    fprintf(stderr, "Sending Header...");
-
-    if(send(sock, file->name, FILENAME_LEN, 0) != FILENAME_LEN)
-       return ERROR;
-
-    if(send(sock, file->size, FILESIZE_LEN, 0) != FILESIZE_LEN)
-        return ERROR;
-
-    printf("OK!\n");
+    if(total == -1){
+        fprintf(stderr, "\rSending stream...%llu bytes", done);
+        return;
+    }
 
-    return SUCCESS;
+    fprintf(stderr, "\rSending message...%d%%", (int)((double)done / total * 100));
 
+    tuner_update(tuner, aleft_session_socket(session), done);
+    aleft_session_set_chunk_size(session, tuner->current.chunkSize);
 }
 
-int send_message(SOCKET sock, File* f){
-
-    char buffer[BUF_SIZE], format[MAX_FORMAT_SIZE];
+int send_file(SOCKET sock, struct sockaddr_storage* address, socklen_t addressLen, File* f, Tuner* tuner){
 
-    double size = atol(f->size);
+    AleftCallbacks callbacks = { .on_progress = on_progress, .user = tuner };
 
-    unsigned rest = (int)size % BUF_SIZE;
-    double totalSent = size - rest;
+    AleftSession* session;
+    if(f->pack != NULL)
+        session = aleft_send_buffer(sock, f->name, f->pack->data, f->pack->size, &callbacks);
+    else
+        session = aleft_send_fd(sock, f->name, fileno(f->file), f->size, &callbacks);
+    if(session == NULL) return ERROR;
 
-    for(double nbSent = 0; nbSent != totalSent; nbSent += BUF_SIZE){
+    aleft_session_set_chunk_size(session, tuner->current.chunkSize);
 
-        fprintf(stderr, "\rSending message...%d%%", (int)(((nbSent / size) * 100))+1);
-        fflush(stdout);
+    // TCP Fast Open: the header and the beginning of the file go with the SYN
+    aleft_session_connect(session, (SOCKADDR*)address, addressLen);
 
-        fscanf(f->file, "%1024c", buffer);
-        if(send(sock, buffer, BUF_SIZE, 0) != BUF_SIZE)
-            return ERROR;
+    int status = SUCCESS;
+    if(aleft_session_run(session) == ALEFT_ERROR){
+        fprintf(stderr, "\nerror: %s\n", aleft_session_error(session));
+        status = ERROR;
     }
+    else
+        printf(" OK!\n");
 
-    sprintf(format, "%%%dc", rest);
-    fscanf(f->file, format, buffer);
-    if(send(sock, buffer, rest, 0) != rest)
-        return ERROR;
-
-    printf(" OK!\n");
-
-    return SUCCESS;
+    aleft_session_free(session);
 
-}
-
-int start_connection(SOCKET sock, SOCKADDR_IN sin){
-
-    fprintf(stderr, "Connection to %s through the port %d...", inet_ntoa(sin.sin_addr), htons(sin.sin_port));
-    
-    int connectionState = connect(sock, (SOCKADDR*)&sin, sizeof(sin));
-    if(connectionState == ERROR)
-        return ERROR;
-
-    printf("OK!\n");
-
-    return SUCCESS;
+    return status;
 }
 
 void stop_connection(SOCKET sock){
@@ -239,22 +255,11 @@ void free_file(File* file){
 
     assert(file != NULL);
 
-    fclose(file->file);
-    free(file);
-}
-
-void fix_name(char* name){
-
-    assert(name != NULL);
-
-    const size_t stringSize = strlen(name);
-    unsigned nbChars = 0;
-
-    for(unsigned i = stringSize - 2; name[i] != '/'; i--){
-
-        nbChars++;        
+    if(file->pack != NULL){
+        free_pack(file->pack);
+        free(file->pack);
     }
-
-    strcpy(name, name+(stringSize-nbChars-1));
-
+    else
+        fclose(file->file);
+    free(file);
 }
@@ -3,48 +3,50 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <assert.h>
 
+#include "../lib/aleft.h"
+#include "tuner.h"
+#include "serve.h"
+#include "pack.h"
+
 typedef int SOCKET;
 
-typedef struct sockaddr_in SOCKADDR_IN;
 typedef struct sockaddr SOCKADDR;
 
-#define BUF_SIZE 1024
+#define USAGE "usage : ./server -i [filename.extension|directory] -a [ip] -p [port] [-n name] [-t]\n" \
+              "        ./server -s [directory] -p [port]\n"
 
-#define MAX_FORMAT_SIZE 7
-#define NB_ARGS 8
-#define MAX_SIZE 9999999999
+#define FILENAME_LEN ALEFT_FILENAME_LEN
 
-#define FILENAME_LEN 128
-#define FILESIZE_LEN 10
+// the longest receiver's address (a host name or an IPv6) and port given
+#define IP_LEN NI_MAXHOST
+#define PORT_LEN NI_MAXSERV
 
 #define ERROR -1
 #define SUCCESS 0
 
+// given as input to read the file from stdin
+#define STDIN_NAME "-"
+
 
 typedef struct{
 
     FILE* file; // the file itself
-    char size[FILESIZE_LEN]; // the file size
+    long long size; // the file size, -1 for a stream
     char name[FILENAME_LEN]; // the filename
+    bool stream; // true if the size is unknown (stdin, a pipe...)
+    Pack* pack; // the files of a directory, sent at once (file is then NULL)
 
 }File;
 
 
-/*
-* return the total size of a file in bytes
-*
-* @return the size of the file called "filename" if success
-* @return 0 else
-*/
-unsigned long get_file_size(char* filename);
-
-
 /*
 * allocate memory for a new file
 *
@@ -55,7 +57,8 @@ File* create_file();
 
 /*
 *
-* opens and initialises the file called "filename"
+* opens and initialises the file called "filename" ("-" for stdin).
+* a directory is packed, and the pack is named after it.
 */
 File* open_file(char* filename);
 
@@ -67,36 +70,13 @@ void free_file(File* file);
 
 
 /*
-* creates a new socket and configure it
-*/
-SOCKET create_socket(int domain, int type, int protocol, SOCKADDR_IN* sin, char* ip, char* port);
-
-
-/*
-* sends f's header using sock
-*
-* @return  0 if everyting went well
-* @return -1 else
-*/
-int send_header(SOCKET sock, File* file);
-
-
-/*
-* sends f using sock
+* sends f through sock, connecting it to address with TCP Fast Open
+* when available. the size of the chunks is given by tuner
 *
 * @return  0 if everyting went well
 * @return -1 else
 */
-int send_message(SOCKET sock, File* f);
-
-
-/*
-* starts the connection
-*
-* @return  0 if everyting went well
-* @return -1 else
-*/
-int start_connection(SOCKET sock, SOCKADDR_IN sin);
+int send_file(SOCKET sock, struct sockaddr_storage* address, socklen_t addressLen, File* f, Tuner* tuner);
 
 
 /*
@@ -107,11 +87,4 @@ void stop_connection(SOCKET sock);
 /*
 * parses command line arguments given to the program
 */
-int parse_arguments(int argc, char** argv, File** f, char* ip, char* port);
-
-/*
-*
-* fixes a file name that is actually a path (example : /home/user/test.txt becomes test.txt)
-*
-*/
-void fix_name(char* name);
\ No newline at end of file
+int parse_arguments(int argc, char** argv, File** f, char* ip, char* port, bool* autoTune, char** serveDir);
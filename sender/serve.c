@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "serve.h"
+#include "../lib/trace.h"
+
+#define ERROR -1
+#define SUCCESS 0
+
+// the connections waiting in the kernel while MAX_CLIENTS are served
+#define SERVE_BACKLOG 16
+
+
+/*
+* hashes the next piece of the range, read into a buffer: a file shortened
+* meanwhile is then an error rather than a SIGBUS, as it'd be with mmap()
+*
+* @return -1 if it couldn't be read
+*/
+static int hash_step(Client* client){
+
+    static char buffer[HASH_STEP]; // the clients are served one at a time
+
+    long long length = client->offset + client->left - client->hashed;
+    if(length > HASH_STEP) length = HASH_STEP;
+
+    for(long long done = 0; done < length;){
+        ssize_t nbRead = TRACE_CALL(read, pread(client->fd, buffer + done, length - done, client->hashed + done));
+        if(nbRead == ERROR && errno == EINTR) continue;
+        if(nbRead <= 0) return ERROR; // the file has been shortened
+        done += nbRead;
+    }
+
+    TRACE_BLOCK(hash, length, aleft_checksum_update(&client->hash, buffer, length));
+
+    client->hashed += length;
+    return SUCCESS;
+}
+
+
+/*
+* the version of the file: its modification time to the nanosecond and its
+* inode (a file replaced within the same tick), hashed to fit in the reply
+*/
+static long long file_version(const struct stat* st){
+
+    long long fields[3] = { st->st_mtim.tv_sec, st->st_mtim.tv_nsec, st->st_ino };
+
+    AleftChecksum checksum;
+    aleft_checksum_init(&checksum);
+    aleft_checksum_update(&checksum, fields, sizeof(fields));
+
+    return aleft_checksum_final(&checksum) % 10000000000ULL; // ALEFT_FILESIZE_LEN digits
+}
+
+
+/*
+* opens the requested file and prepares the reply
+*/
+static void answer(Client* client, int dirfd){
+
+    AleftRange range;
+    AleftReply reply = { .fileSize = -1 };
+    struct stat st;
+
+    if(aleft_decode_request(client->request, &range)
+       && (client->fd = openat(dirfd, range.name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK)) != ERROR){
+
+        // O_NONBLOCK so that a FIFO doesn't block openat(), it isn't served anyway
+        if(fstat(client->fd, &st) == SUCCESS && S_ISREG(st.st_mode)){
+
+            reply.fileSize = st.st_size;
+            reply.version = file_version(&st);
+            reply.length = 0;
+            if(range.offset < st.st_size)
+                reply.length = st.st_size - range.offset < range.length ? st.st_size - range.offset : range.length;
+
+            client->offset = range.offset;
+            client->left = reply.length;
+            client->checksum = range.checksum;
+            client->hashed = range.offset;
+            aleft_checksum_init(&client->hash);
+        }
+        else{
+            close(client->fd);
+            client->fd = ERROR;
+        }
+    }
+
+    if(reply.fileSize == -1){
+        client->left = 0;
+        client->checksum = false;
+    }
+
+    aleft_encode_reply(client->reply, &reply);
+    client->replySize = ALEFT_REPLY_LEN;
+    client->replyDone = 0;
+    client->state = CLIENT_REPLY;
+}
+
+
+/*
+* sends what's left of client->reply
+*
+* @return 1 once it's all sent, 0 if the socket is full, -1 on error
+*/
+static int send_reply(Client* client, int flags){
+
+    while(client->replyDone < client->replySize){
+
+        ssize_t sent = send(client->sock, client->reply + client->replyDone,
+                            client->replySize - client->replyDone, flags | MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(sent == ERROR){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return ERROR;
+        }
+        client->replyDone += sent;
+    }
+
+    return 1;
+}
+
+
+/*
+* moves client's transfer forward as much as its socket allows
+*
+* @return the poll() events to wait for, or -1 if the connection is over
+*/
+static int handle(Client* client, int dirfd){
+
+    while(true){
+
+        switch(client->state){
+
+            case CLIENT_REQUEST:{
+                ssize_t received = recv(client->sock, client->request + client->requestDone,
+                                        ALEFT_REQUEST_LEN - client->requestDone, MSG_DONTWAIT);
+                if(received == ERROR && errno == EINTR) continue;
+                if(received == ERROR && (errno == EAGAIN || errno == EWOULDBLOCK)) return POLLIN;
+                if(received <= 0) return ERROR;
+
+                client->requestDone += received;
+                if(client->requestDone == ALEFT_REQUEST_LEN){
+                    client->requestDone = 0;
+                    answer(client, dirfd);
+                }
+            }
+            break;
+
+            case CLIENT_REPLY:{
+                int status = send_reply(client, client->left > 0 ? MSG_MORE : 0);
+                if(status != 1) return status == 0 ? POLLOUT : ERROR;
+                client->state = CLIENT_RANGE;
+            }
+            break;
+
+            case CLIENT_RANGE:{
+                // straight from the page cache to the socket, hashed a step ahead
+                while(client->left > 0){
+                    if(client->checksum && client->hashed == client->offset && hash_step(client) == ERROR)
+                        return ERROR;
+
+                    long long size = client->checksum ? client->hashed - client->offset : client->left;
+                    ssize_t sent = TRACE_CALL(send, sendfile(client->sock, client->fd, &client->offset, size));
+                    if(sent == ERROR && errno == EINTR) continue;
+                    if(sent == ERROR && (errno == EAGAIN || errno == EWOULDBLOCK)) return POLLOUT;
+                    if(sent <= 0) return ERROR; // the file has been shortened
+                    client->left -= sent;
+                }
+
+                if(client->fd != ERROR){
+                    close(client->fd);
+                    client->fd = ERROR;
+                }
+
+                if(client->checksum){
+                    char hash[ALEFT_CHECKSUM_LEN+1];
+                    snprintf(hash, sizeof(hash), "%016llx", aleft_checksum_final(&client->hash));
+                    memcpy(client->reply, hash, ALEFT_CHECKSUM_LEN);
+                    client->replySize = ALEFT_CHECKSUM_LEN;
+                    client->replyDone = 0;
+                    client->state = CLIENT_CHECKSUM;
+                }
+                else
+                    client->state = CLIENT_REQUEST;
+            }
+            break;
+
+            case CLIENT_CHECKSUM:{
+                int status = send_reply(client, 0);
+                if(status != 1) return status == 0 ? POLLOUT : ERROR;
+                client->state = CLIENT_REQUEST;
+            }
+            break;
+        }
+    }
+}
+
+
+static void drop_client(Client* client){
+
+    if(client->fd != ERROR) close(client->fd);
+    close(client->sock);
+}
+
+
+int serve(const char* port, const char* dir){
+
+    int dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+    if(dirfd == ERROR){
+        fprintf(stderr, "error: unable to open \"%s\"\n", dir);
+        return ERROR;
+    }
+
+    int listener = aleft_listen(port, SERVE_BACKLOG);
+    if(listener == ERROR){
+        fprintf(stderr, "error: unable to listen on port %s\n", port);
+        close(dirfd);
+        return ERROR;
+    }
+
+    fprintf(stderr, "Serving \"%s\" on port %s...\n", dir, port);
+
+    // fds[0] is the listener, fds[i+1] is clients[i]
+    static Client clients[MAX_CLIENTS];
+    struct pollfd fds[MAX_CLIENTS+1];
+    int nbClients = 0;
+
+    fds[0].fd = listener;
+    fds[0].events = POLLIN;
+
+    while(true){
+
+        if(poll(fds, nbClients+1, -1) == ERROR){
+            if(errno == EINTR) continue;
+            break;
+        }
+
+        for(int i = 0; i < nbClients; i++){
+
+            if(fds[i+1].revents == 0) continue;
+
+            int events = handle(&clients[i], dirfd);
+            if(events != ERROR){
+                fds[i+1].events = events;
+                continue;
+            }
+
+            // the last client takes the place of the one that left
+            drop_client(&clients[i]);
+            nbClients--;
+            clients[i] = clients[nbClients];
+            fds[i+1] = fds[nbClients+1];
+            i--;
+        }
+
+        if((fds[0].revents & POLLIN) && nbClients < MAX_CLIENTS){
+
+            int sock = aleft_accept(listener, NULL, 0);
+            if(sock == ERROR) continue;
+
+            // sendfile() must not block the other clients when the socket is full
+            if(fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) == ERROR){
+                close(sock);
+                continue;
+            }
+
+            Client* client = &clients[nbClients];
+            memset(client, 0, sizeof(*client));
+            client->sock = sock;
+            client->fd = ERROR;
+            client->state = CLIENT_REQUEST;
+
+            fds[nbClients+1].fd = sock;
+            fds[nbClients+1].events = POLLIN;
+            fds[nbClients+1].revents = 0;
+            nbClients++;
+        }
+
+        // no more room: the listener waits until a client leaves
+        fds[0].events = nbClients < MAX_CLIENTS ? POLLIN : 0;
+    }
+
+    for(int i = 0; i < nbClients; i++)
+        drop_client(&clients[i]);
+    close(listener);
+    close(dirfd);
+
+    return SUCCESS;
+}
@@ -0,0 +1,60 @@
+#ifndef __SERVE__
+#define __SERVE__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "../lib/aleft.h"
+
+/*
+* in serve mode, the sender listens and answers the range requests of
+* receivers in pull mode (see lib/aleft.h) with the files of a directory.
+*
+* every connection is handled by the same poll() loop: a request is read,
+* the range is sent from the page cache with sendfile(), followed by its
+* checksum if asked, and the next request of that connection is read.
+* the checksum is computed along, one HASH_STEP ahead of what's sent,
+* so that a large range doesn't keep the other connections waiting.
+*/
+
+#define MAX_CLIENTS 64
+#define HASH_STEP (1024*1024)
+
+// the states of a client's connection
+#define CLIENT_REQUEST 0 // reading a request
+#define CLIENT_REPLY 1 // sending the reply
+#define CLIENT_RANGE 2 // sending the range
+#define CLIENT_CHECKSUM 3 // sending the range's checksum
+
+typedef struct{
+
+    int sock;
+    int state;
+
+    char request[ALEFT_REQUEST_LEN];
+    size_t requestDone;
+
+    char reply[ALEFT_REPLY_LEN > ALEFT_CHECKSUM_LEN ? ALEFT_REPLY_LEN : ALEFT_CHECKSUM_LEN];
+    size_t replySize, replyDone; // the reply, then the checksum
+
+    int fd; // the requested file
+    off_t offset; // where the range is in the file
+    long long left; // bytes of the range left to send
+    bool checksum; // true if the range's checksum follows it
+    AleftChecksum hash; // of the range
+    off_t hashed; // where the range has been hashed up to
+
+}Client;
+
+
+/*
+* answers the range requests made on port with the files of dir,
+* until the program is interrupted
+*
+* @return -1 if the socket couldn't be created
+*/
+int serve(const char* port, const char* dir);
+
+
+#endif // __SERVE__
@@ -0,0 +1,237 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "tuner.h"
+
+/*
+* the chunk sizes probed first, then the send buffer sizes
+*/
+static const size_t CHUNK_CANDIDATES[] = { 4*1024, 16*1024, 64*1024, 256*1024, MAX_CHUNK_SIZE };
+static const int SNDBUF_CANDIDATES[] = { 256*1024, 1024*1024, 4*1024*1024 };
+
+#define NB_CHUNK_CANDIDATES (int)(sizeof(CHUNK_CANDIDATES)/sizeof(CHUNK_CANDIDATES[0]))
+#define NB_CANDIDATES (NB_CHUNK_CANDIDATES + (int)(sizeof(SNDBUF_CANDIDATES)/sizeof(SNDBUF_CANDIDATES[0])))
+
+
+/*
+* gets the path of the profiles file
+*
+* @return 0 if everything went well
+* @return -1 else
+*/
+static int profiles_path(char* path, size_t size){
+
+    const char* home = getenv("HOME");
+    if(home == NULL) return -1;
+
+    if(snprintf(path, size, "%s/%s", home, PROFILES_NAME) >= (int)size) return -1;
+
+    return 0;
+}
+
+
+/*
+* looks for the profile learned for destination
+*
+* @return 0 if one has been found
+* @return -1 else
+*/
+static int load_profile(const char* destination, Profile* profile){
+
+    char path[FILENAME_MAX];
+    if(profiles_path(path, sizeof(path)) == -1) return -1;
+
+    FILE* profiles = fopen(path, "r");
+    if(profiles == NULL) return -1;
+
+    // "destination chunkSize sndBuf"
+    char line[DESTINATION_LEN+64], dest[DESTINATION_LEN];
+    int found = -1;
+    while(found == -1 && fgets(line, sizeof(line), profiles) != NULL){
+
+        size_t chunkSize;
+        int sndBuf;
+        if(sscanf(line, "%63s %zu %d", dest, &chunkSize, &sndBuf) != 3) continue;
+        if(strcmp(dest, destination) != 0) continue;
+        if(chunkSize == 0 || chunkSize > MAX_CHUNK_SIZE || sndBuf < 0) continue;
+
+        profile->chunkSize = chunkSize;
+        profile->sndBuf = sndBuf;
+        found = 0;
+    }
+
+    fclose(profiles);
+    return found;
+}
+
+
+/*
+* saves the profile learned for destination, replacing the previous one
+*/
+static void save_profile(const char* destination, const Profile* profile, double throughput){
+
+    char path[FILENAME_MAX], tmpPath[FILENAME_MAX+8];
+    if(profiles_path(path, sizeof(path)) == -1) return;
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+
+    FILE* tmp = fopen(tmpPath, "w");
+    if(tmp == NULL) return;
+
+    // the other destinations' profiles are kept
+    FILE* profiles = fopen(path, "r");
+    if(profiles != NULL){
+
+        char line[DESTINATION_LEN+64], dest[DESTINATION_LEN];
+        while(fgets(line, sizeof(line), profiles) != NULL){
+
+            if(sscanf(line, "%63s", dest) == 1 && strcmp(dest, destination) == 0) continue;
+            fputs(line, tmp);
+        }
+        fclose(profiles);
+    }
+
+    fprintf(tmp, "%s %zu %d %.0f\n", destination, profile->chunkSize, profile->sndBuf, throughput);
+
+    if(fclose(tmp) == 0)
+        rename(tmpPath, path);
+    else
+        remove(tmpPath);
+}
+
+
+/*
+* the profile probed at step
+*/
+static Profile candidate(Tuner* tuner, int step){
+
+    Profile profile = tuner->best;
+
+    if(step < NB_CHUNK_CANDIDATES){
+        profile.chunkSize = CHUNK_CANDIDATES[step];
+        profile.sndBuf = 0;
+    }
+    else
+        profile.sndBuf = SNDBUF_CANDIDATES[step - NB_CHUNK_CANDIDATES];
+
+    return profile;
+}
+
+
+/*
+* bytes sent through sock that the receiver has acknowledged
+*/
+static unsigned long delivered(int sock, unsigned long totalSent){
+
+    int unacked = 0;
+    if(ioctl(sock, TIOCOUTQ, &unacked) == -1 || unacked < 0) unacked = 0;
+
+    return (unsigned long)unacked > totalSent ? 0 : totalSent - unacked;
+}
+
+
+/*
+* the median of the throughputs measured for a candidate
+*/
+static double median(double* throughputs){
+
+    // insertion sort, there are only TUNE_WINDOWS of them
+    for(int i = 1; i < TUNE_WINDOWS; i++)
+        for(int j = i; j > 0 && throughputs[j-1] > throughputs[j]; j--){
+            double swap = throughputs[j];
+            throughputs[j] = throughputs[j-1];
+            throughputs[j-1] = swap;
+        }
+
+    return throughputs[TUNE_WINDOWS/2];
+}
+
+
+void tuner_init(Tuner* tuner, const char* destination, bool autoTune, size_t defaultChunkSize){
+
+    assert(tuner != NULL && destination != NULL);
+
+    snprintf(tuner->destination, DESTINATION_LEN, "%s", destination);
+    tuner->current.chunkSize = defaultChunkSize;
+    tuner->current.sndBuf = 0;
+    tuner->best = tuner->current;
+    tuner->bestThroughput = 0;
+    tuner->step = -1;
+
+    if(!autoTune) return;
+
+    if(load_profile(destination, &tuner->current) == 0){
+        fprintf(stderr, "Using the profile learned for %s (chunks of %zu bytes, send buffer of %d bytes)\n",
+                destination, tuner->current.chunkSize, tuner->current.sndBuf);
+        return;
+    }
+
+    tuner->step = 0;
+    tuner->window = 0;
+    tuner->current = candidate(tuner, 0);
+    tuner->windowDelivered = 0;
+    tuner->windowStart.tv_sec = 0;
+    tuner->windowStart.tv_nsec = 0;
+}
+
+
+void tuner_apply(Tuner* tuner, int sock){
+
+    if(tuner->current.sndBuf > 0)
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &tuner->current.sndBuf, sizeof(int));
+}
+
+
+void tuner_update(Tuner* tuner, int sock, unsigned long totalSent){
+
+    if(tuner->step == -1) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // the first window starts with the first chunk
+    if(tuner->windowStart.tv_sec == 0 && tuner->windowStart.tv_nsec == 0){
+        tuner->windowStart = now;
+        tuner->windowDelivered = delivered(sock, totalSent);
+        return;
+    }
+
+    double elapsed = (now.tv_sec - tuner->windowStart.tv_sec) + (now.tv_nsec - tuner->windowStart.tv_nsec) / 1e9;
+    if(elapsed * 1000 < TUNE_WINDOW_MS) return;
+
+    unsigned long nowDelivered = delivered(sock, totalSent);
+    tuner->throughputs[tuner->window++] = (nowDelivered - tuner->windowDelivered) / elapsed;
+    tuner->windowStart = now;
+    tuner->windowDelivered = nowDelivered;
+    if(tuner->window < TUNE_WINDOWS) return;
+
+    double throughput = median(tuner->throughputs);
+    if(throughput > tuner->bestThroughput){
+        tuner->bestThroughput = throughput;
+        tuner->best = tuner->current;
+    }
+
+    tuner->window = 0;
+    tuner->step++;
+    if(tuner->step == NB_CANDIDATES){
+
+        tuner->step = -1;
+        tuner->current = tuner->best;
+        save_profile(tuner->destination, &tuner->best, tuner->bestThroughput);
+        fprintf(stderr, "\nTuned for %s: chunks of %zu bytes, send buffer of %d bytes (%.1f MB/s)\n",
+                tuner->destination, tuner->best.chunkSize, tuner->best.sndBuf, tuner->bestThroughput / 1e6);
+    }
+    else
+        tuner->current = candidate(tuner, tuner->step);
+
+    /*
+    * once SO_SNDBUF has been set, the kernel doesn't tune the buffer anymore:
+    * if it did best, this transfer keeps the last probed size,
+    * the next ones will start with the kernel's tuning
+    */
+    tuner_apply(tuner, sock);
+}
@@ -0,0 +1,75 @@
+#ifndef __TUNER__
+#define __TUNER__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/*
+* the auto-tuner looks for the chunk size and the socket's send buffer
+* size giving the best throughput towards a destination.
+*
+* during the first seconds of the transfer, each candidate is used for
+* TUNE_WINDOWS windows of TUNE_WINDOW_MS, and the throughput is measured
+* in each from the bytes acknowledged by the receiver (sent bytes minus
+* what's left in the send queue). a candidate is rated by the median of
+* its windows, so that one lucky or disturbed window doesn't decide.
+* the chunk sizes are probed first, then the send buffer sizes with the
+* best chunk size. the best profile is then kept until the end, and saved
+* in PROFILES_NAME (in $HOME) to be reused by the next transfers to the
+* same destination without probing.
+*/
+
+#define TUNE_WINDOW_MS 100
+#define TUNE_WINDOWS 3
+#define MAX_CHUNK_SIZE (1024*1024)
+#define PROFILES_NAME ".aleft_profiles"
+#define DESTINATION_LEN 64
+
+typedef struct{
+
+    size_t chunkSize; // bytes read and sent at once
+    int sndBuf; // SO_SNDBUF, 0 to let the kernel tune it
+
+}Profile;
+
+typedef struct{
+
+    char destination[DESTINATION_LEN]; // "ip:port"
+    Profile current; // the profile in use
+    Profile best; // the best one so far
+    double bestThroughput; // bytes per second
+    int step; // the candidate being probed, -1 if not probing
+    int window; // the window of the candidate being measured
+    double throughputs[TUNE_WINDOWS]; // measured in its windows so far
+    struct timespec windowStart; // zero until the first chunk has been sent
+    unsigned long windowDelivered; // bytes acknowledged at windowStart
+
+}Tuner;
+
+
+/*
+* initialises the tuner for the transfers to destination.
+* if autoTune is false, or if a profile has been learned for destination,
+* there's nothing to probe
+*/
+void tuner_init(Tuner* tuner, const char* destination, bool autoTune, size_t defaultChunkSize);
+
+
+/*
+* applies the current profile's send buffer size to sock
+*/
+void tuner_apply(Tuner* tuner, int sock);
+
+
+/*
+* measures the throughput if the probing window is over, and once the
+* candidate's windows are over, moves on to the next candidate. once all
+* of them have been probed, the best one is applied and saved.
+*
+* @param totalSent bytes sent through sock so far
+*/
+void tuner_update(Tuner* tuner, int sock, unsigned long totalSent);
+
+
+#endif // __TUNER__
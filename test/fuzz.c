@@ -0,0 +1,175 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This test is a part of the ALEFT Project.
+ *       It gives whatever Bytes it's given to the parsers of libaleft,
+ *       one by one and as the stream a receive session reads, so that
+ *       a fuzzer can look for what makes them read or write out of bounds.
+ * */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../lib/aleft.h"
+
+/*
+Built three ways (see the Makefile):
+    - make fuzz: with a main() that runs the files given on the command line,
+      e.g. the seed corpus, under AddressSanitizer and UBSan. AFL uses the
+      same main() (CC=afl-clang-fast), with @@ as the file.
+    - make fuzz-libfuzzer: clang -fsanitize=fuzzer -DALEFT_LIBFUZZER, then
+      ./fuzz-libfuzzer corpus/
+
+Every input goes through:
+    - aleft_check_header() and aleft_decode_header(), aleft_decode_request(),
+      aleft_decode_reply(), aleft_decode_checksum(), each given a copy of
+      exactly the Bytes it may read, so that reading one more is caught
+    - aleft_decode_pack(), given the whole input
+    - a receive session, which reads the input from a socket in fragments
+      of 1, 2, 3, 5... Bytes: the file goes to /dev/null, or to memory when
+      the first Byte is odd, without any limit, as a header can't make the
+      session allocate more than the Bytes that actually came
+*/
+
+/**
+ * @return a copy of the first len Bytes of data, padded with NULs
+ *         if there are less, in a block of exactly len Bytes
+ * */
+static char* exact_copy(const uint8_t* data, size_t size, size_t len) {
+    char* copy = calloc(1, len);
+    if (copy)
+        memcpy(copy, data, size < len ? size : len);
+    return copy;
+}
+
+static void fuzz_parsers(const uint8_t* data, size_t size) {
+    char* header = exact_copy(data, size, ALEFT_HEADER_LEN);
+    if (header && aleft_check_header(header)) {
+        char name[ALEFT_FILENAME_LEN+1];
+        long long fileSize;
+        aleft_decode_header(header, name, &fileSize);
+        if (!aleft_check_name(name) || fileSize < -1 || fileSize > ALEFT_MAX_SIZE)
+            abort(); // a checked header has to decode to something valid
+    }
+    free(header);
+
+    char* request = exact_copy(data, size, ALEFT_REQUEST_LEN);
+    AleftRange range;
+    if (request && aleft_decode_request(request, &range) && !aleft_check_name(range.name))
+        abort();
+    free(request);
+
+    char* reply = exact_copy(data, size, ALEFT_REPLY_LEN);
+    AleftReply answer;
+    if (reply)
+        aleft_decode_reply(reply, &answer);
+    free(reply);
+
+    char* checksum = exact_copy(data, size, ALEFT_CHECKSUM_LEN);
+    unsigned long long hash;
+    if (checksum)
+        aleft_decode_checksum(checksum, &hash);
+    free(checksum);
+
+    char* pack = exact_copy(data, size, size);
+    if (pack || size == 0)
+        aleft_decode_pack(pack, size);
+    free(pack);
+}
+
+static int devNull = -1;
+
+static int on_header(AleftSession* session, const char* name, long long size, void* user) {
+    bool inMemory = *(bool*) user;
+    return inMemory ? -1 : devNull;
+}
+
+static void fuzz_session(const uint8_t* data, size_t size) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == -1)
+        return;
+    fcntl(sockets[0], F_SETFL, O_NONBLOCK);
+
+    bool inMemory = size > 0 && data[0] % 2;
+    AleftCallbacks callbacks = { .on_header = on_header, .user = &inMemory };
+    AleftSession* session = aleft_recv(sockets[1], -1, &callbacks);
+    if (!session) {
+        close(sockets[0]);
+        close(sockets[1]);
+        return;
+    }
+
+    static const size_t fragments[] = { 1, 2, 3, 5, 8, 13, 21, 34, 55, 89, 144, 233 };
+    size_t nbFragments = sizeof fragments / sizeof *fragments;
+    size_t done = 0;
+    int status = ALEFT_AGAIN;
+    for (size_t i = 0; status == ALEFT_AGAIN && done < size; i++) {
+        size_t fragment = fragments[i % nbFragments];
+        ssize_t sent = send(sockets[0], data + done, fragment < size - done ? fragment : size - done, MSG_NOSIGNAL);
+        if (sent > 0)
+            done += sent;
+        status = aleft_session_step(session);
+    }
+
+    // The end of the input is a disconnection
+    shutdown(sockets[0], SHUT_WR);
+    while (status == ALEFT_AGAIN)
+        status = aleft_session_step(session);
+
+    aleft_session_free(session);
+    close(sockets[0]);
+    close(sockets[1]);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (devNull == -1)
+        devNull = open("/dev/null", O_WRONLY);
+    fuzz_parsers(data, size);
+    fuzz_session(data, size);
+    return 0;
+}
+
+#ifndef ALEFT_LIBFUZZER
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s FILE...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        FILE* input = fopen(argv[i], "rb");
+        if (!input) {
+            perror(argv[i]);
+            return EXIT_FAILURE;
+        }
+        uint8_t* data = NULL;
+        size_t size = 0, capacity = 0;
+        size_t nbRead;
+        do {
+            if (size == capacity) {
+                capacity = capacity ? 2*capacity : 4096;
+                uint8_t* grown = realloc(data, capacity);
+                if (!grown)
+                    return EXIT_FAILURE;
+                data = grown;
+            }
+            nbRead = fread(data + size, 1, capacity - size, input);
+            size += nbRead;
+        } while (nbRead > 0);
+        fclose(input);
+
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+    }
+
+    printf("%d inputs run\n", argc-1);
+    return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,391 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This test is a part of the ALEFT Project.
+ *       It runs the sender and receivers over loopback, relaying files
+ *       and packs, kills a receiver in the middle of a file, and checks
+ *       what each of them leaves in its directory.
+ * */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "../lib/aleft.h"
+
+/*
+The programs are those built in ../receiver and ../sender, each run from
+its own directory of a temporary one, with its output in a log:
+
+    - relays:   a receiver forwards a file and a stream to two receivers,
+                one of which forwards them to a third, and to a port where
+                nobody listens; each of the three gets them Byte for Byte
+    - pack:     a directory is sent as a pack, then sent again with a file
+                removed and one changed, and replaces the first one
+    - recovery: a receiver killed in the middle of a file, with the
+                temporary directory of an interrupted unpacking next to it:
+                the next receiver started there removes both
+
+The transfers are waited for through the logs, at most LOOPBACK_WAIT_S each.
+*/
+
+#define LOOPBACK_WAIT_S 10
+#define LOOPBACK_TIMEOUT_S 120
+#define LOOPBACK_FILE_SIZE (3*1024*1024)
+#define LOOPBACK_PACK_FILES 20
+
+#define COMPLETED "Transfer completed successfully."
+
+static char receiverPath[PATH_MAX], senderPath[PATH_MAX];
+static int nbFailed = 0;
+static unsigned long long seed = 0x9e3779b97f4a7c15ULL;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("%s: FAILED\n", what);
+        nbFailed++;
+    }
+}
+
+static unsigned long long xorshift(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static int write_file(const char* path, size_t size) {
+    char* data = malloc(size ? size : 1);
+    if (!data)
+        return -1;
+    for (size_t i = 0; i < size; i++)
+        data[i] = xorshift();
+
+    FILE* file = fopen(path, "w");
+    int status = file && fwrite(data, 1, size, file) == size ? 0 : -1;
+    if (file && fclose(file) == EOF)
+        status = -1;
+    free(data);
+    return status;
+}
+
+static bool same_file(const char* path, const char* other) {
+    FILE* a = fopen(path, "r");
+    FILE* b = fopen(other, "r");
+    bool same = a && b;
+    while (same) {
+        int c = getc(a);
+        same = c == getc(b);
+        if (c == EOF)
+            break;
+    }
+    if (a)
+        fclose(a);
+    if (b)
+        fclose(b);
+    return same;
+}
+
+/**
+ * @return true if dir holds nothing the receiver only uses while receiving
+ * */
+static bool no_tmp(const char* dir) {
+    DIR* d = opendir(dir);
+    if (!d)
+        return false;
+    bool clean = true;
+    struct dirent* entry;
+    while ((entry = readdir(d)))
+        if (strncmp(entry->d_name, ALEFT_TMP_PREFIX, strlen(ALEFT_TMP_PREFIX)) == 0)
+            clean = false;
+    closedir(d);
+    return clean;
+}
+
+/**
+ * @return a port nobody listens on for now
+ * */
+static void free_port(char* port) {
+    struct sockaddr_in local = { .sin_family = AF_INET, .sin_port = 0, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t localLen = sizeof local;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1 || bind(sock, (struct sockaddr*) &local, sizeof local) == -1
+        || getsockname(sock, (struct sockaddr*) &local, &localLen) == -1)
+        strcpy(port, "0");
+    else
+        sprintf(port, "%d", ntohs(local.sin_port));
+    if (sock != -1)
+        close(sock);
+}
+
+/**
+ * Runs argv from dir, with input as stdin (or /dev/null if it's -1)
+ * and its stdout and stderr in dir/log
+ * */
+static pid_t run(const char* dir, int input, char* const argv[]) {
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+
+    int log = -1;
+    if (chdir(dir) == 0)
+        log = open("log", O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (input == -1)
+        input = open("/dev/null", O_RDONLY);
+    if (log == -1 || input == -1 || dup2(input, STDIN_FILENO) == -1
+        || dup2(log, STDOUT_FILENO) == -1 || dup2(log, STDERR_FILENO) == -1)
+        _exit(127);
+    execv(argv[0], argv);
+    _exit(127);
+}
+
+/**
+ * @return the exit status of pid, -1 if it didn't exit by itself
+ * */
+static int finish(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) == -1)
+        if (errno != EINTR)
+            return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/**
+ * Stops a receiver listening with -k as Ctrl+C would
+ * */
+static int stop(pid_t pid) {
+    kill(pid, SIGTERM);
+    return finish(pid);
+}
+
+/**
+ * @return true once dir/log holds text at least count times
+ * */
+static bool wait_log(const char* dir, const char* text, int count) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof path, "%s/log", dir);
+    for (int tries = 0; tries < LOOPBACK_WAIT_S * 100; tries++) {
+        FILE* log = fopen(path, "r");
+        if (log) {
+            static char content[1 << 20];
+            size_t size = fread(content, 1, sizeof content - 1, log);
+            content[size] = '\0';
+            fclose(log);
+
+            int found = 0;
+            for (const char* at = content; (at = strstr(at, text)); at += strlen(text))
+                found++;
+            if (found >= count)
+                return true;
+        }
+        struct timespec delay = { 0, 10 * 1000 * 1000 };
+        nanosleep(&delay, NULL);
+    }
+    return false;
+}
+
+static pid_t start_receiver(const char* dir, const char* port, char* const relays[]) {
+    char* argv[16] = { receiverPath, "-p", (char*) port, "-k" };
+    int argc = 4;
+    for (int i = 0; relays && relays[i] && argc < 14; i++) {
+        argv[argc++] = "-f";
+        argv[argc++] = relays[i];
+    }
+    argv[argc] = NULL;
+    pid_t pid = run(dir, -1, argv);
+    check(wait_log(dir, "Listening", 1), "a receiver starts");
+    return pid;
+}
+
+static int send_file(const char* dir, const char* port, const char* path) {
+    char* argv[] = { senderPath, "-p", (char*) port, "-a", "127.0.0.1", "-i", (char*) path, NULL };
+    return finish(run(dir, -1, argv));
+}
+
+static void test_relays(void) {
+    const char* dirs[] = { "a", "b", "c", "d" };
+    char ports[4][8], relayB[32], relayC[32], relayD[32], nobody[32], unused[8];
+    for (int i = 0; i < 4; i++) {
+        mkdir(dirs[i], 0700);
+        free_port(ports[i]);
+    }
+    free_port(unused);
+    snprintf(relayB, sizeof relayB, "127.0.0.1:%s", ports[1]);
+    snprintf(relayC, sizeof relayC, "127.0.0.1:%s", ports[2]);
+    snprintf(relayD, sizeof relayD, "127.0.0.1:%s", ports[3]);
+    snprintf(nobody, sizeof nobody, "127.0.0.1:%s", unused);
+
+    // a -> b -> c, a -> d, and a -> nobody: the children listen first
+    pid_t pids[4];
+    pids[2] = start_receiver("c", ports[2], NULL);
+    pids[3] = start_receiver("d", ports[3], NULL);
+    pids[1] = start_receiver("b", ports[1], (char*[]) { relayC, NULL });
+    pids[0] = start_receiver("a", ports[0], (char*[]) { relayB, relayD, nobody, NULL });
+
+    check(write_file("file.bin", LOOPBACK_FILE_SIZE) == 0, "relays: writing the file");
+    check(send_file(".", ports[0], "file.bin") == 0, "relays: the sender sends the file");
+    for (int i = 0; i < 4; i++)
+        check(wait_log(dirs[i], COMPLETED, 1), "relays: the file is received");
+
+    // a stream: the sender reads a pipe
+    int pipefd[2];
+    check(write_file("stream.bin", LOOPBACK_FILE_SIZE / 3) == 0 && pipe2(pipefd, O_CLOEXEC) == 0,
+          "relays: writing the stream");
+    char* argv[] = { senderPath, "-p", ports[0], "-a", "127.0.0.1", "-i", "-", "-n", "stream.bin", NULL };
+    pid_t sender = run(".", pipefd[0], argv);
+    close(pipefd[0]);
+    FILE* stream = fopen("stream.bin", "r");
+    char buffer[4096];
+    size_t size;
+    while (stream && (size = fread(buffer, 1, sizeof buffer, stream)) > 0)
+        if (write(pipefd[1], buffer, size) != (ssize_t) size)
+            break;
+    if (stream)
+        fclose(stream);
+    close(pipefd[1]);
+    check(finish(sender) == 0, "relays: the sender sends the stream");
+    for (int i = 0; i < 4; i++)
+        check(wait_log(dirs[i], COMPLETED, 2), "relays: the stream is received");
+
+    for (int i = 0; i < 4; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof path, "%s/file.bin", dirs[i]);
+        check(same_file(path, "file.bin"), "relays: the file is the same everywhere");
+        snprintf(path, sizeof path, "%s/stream.bin", dirs[i]);
+        check(same_file(path, "stream.bin"), "relays: the stream is the same everywhere");
+        check(no_tmp(dirs[i]), "relays: no temporary file is left");
+    }
+    check(wait_log("a", "Relayed to 2 receiver(s)", 2), "relays: a relays to b and d");
+    check(wait_log("a", "1 couldn't be reached", 2), "relays: a reports the port where nobody listens");
+    check(wait_log("b", "Relayed to 1 receiver(s)", 2), "relays: b relays to c");
+
+    for (int i = 0; i < 4; i++)
+        check(stop(pids[i]) == 0, "relays: the receivers succeed");
+}
+
+static void test_pack(void) {
+    mkdir("e", 0700);
+    mkdir("photos", 0700);
+    for (int i = 0; i < LOOPBACK_PACK_FILES; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof path, "photos/%02d.jpg", i);
+        check(write_file(path, i == 0 ? 0 : xorshift() % (100*1024)) == 0, "pack: writing the directory");
+    }
+
+    char port[8];
+    free_port(port);
+    pid_t receiver = start_receiver("e", port, NULL);
+
+    check(send_file(".", port, "photos/") == 0, "pack: the sender sends the directory");
+    check(wait_log("e", COMPLETED, 1), "pack: the pack is received");
+    check(wait_log("e", "files unpacked", 1), "pack: the pack is unpacked");
+    for (int i = 0; i < LOOPBACK_PACK_FILES; i++) {
+        char path[PATH_MAX], received[PATH_MAX+2];
+        snprintf(path, sizeof path, "photos/%02d.jpg", i);
+        snprintf(received, sizeof received, "e/%s", path);
+        check(same_file(received, path), "pack: the files are the same");
+    }
+
+    // the second pack replaces the first directory
+    check(unlink("photos/01.jpg") == 0 && write_file("photos/02.jpg", 1000) == 0, "pack: changing the directory");
+    check(send_file(".", port, "photos/.") == 0, "pack: the sender sends the directory again");
+    check(wait_log("e", COMPLETED, 2), "pack: the second pack is received");
+    check(access("e/photos/01.jpg", F_OK) == -1, "pack: the removed file is gone");
+    check(same_file("e/photos/02.jpg", "photos/02.jpg"), "pack: the changed file is changed");
+    check(no_tmp("e"), "pack: no temporary directory is left");
+
+    check(stop(receiver) == 0, "pack: the receiver succeeds");
+}
+
+static void test_recovery(void) {
+    mkdir("f", 0700);
+    char port[8];
+    free_port(port);
+    pid_t receiver = start_receiver("f", port, NULL);
+
+    // half of a file, by hand, and the receiver is killed as it waits for the rest
+    struct sockaddr_storage address;
+    socklen_t addressLen;
+    int sock = aleft_socket("127.0.0.1", port, &address, &addressLen);
+    char header[ALEFT_HEADER_LEN];
+    char content[4096] = {0};
+    aleft_encode_header(header, "killed.bin", 1024*1024);
+    check(sock != -1 && connect(sock, (struct sockaddr*) &address, addressLen) == 0
+          && send(sock, header, sizeof header, 0) == sizeof header
+          && send(sock, content, sizeof content, 0) == sizeof content, "recovery: sending half a file");
+    check(wait_log("f", "Awaiting file", 1), "recovery: the file is being received");
+    kill(receiver, SIGKILL);
+    finish(receiver);
+    if (sock != -1)
+        close(sock);
+
+    // and the temporary directory of a pack whose unpacking has been interrupted
+    FILE* journal = fopen("f/"ALEFT_JOURNAL_NAME, "a");
+    check(journal && fprintf(journal, "B "ALEFT_TMP_PREFIX"0dead0 5 album/\n") > 0
+          && mkdir("f/"ALEFT_TMP_PREFIX"0dead0", 0700) == 0
+          && write_file("f/"ALEFT_TMP_PREFIX"0dead0/00.jpg", 5) == 0, "recovery: interrupting an unpacking");
+    if (journal)
+        fclose(journal);
+
+    free_port(port);
+    receiver = start_receiver("f", port, NULL);
+    check(wait_log("f", "Interrupted transfer of killed.bin discarded", 1), "recovery: the file is reported");
+    check(wait_log("f", "Interrupted transfer of album/ discarded", 1), "recovery: the pack is reported");
+    check(access("f/killed.bin", F_OK) == -1, "recovery: the file isn't there");
+    check(no_tmp("f"), "recovery: the temporary files are removed");
+
+    struct stat st;
+    check(stat("f/"ALEFT_JOURNAL_NAME, &st) == 0 && st.st_size == 0, "recovery: the journal is emptied");
+
+    // and the receiver goes on
+    check(send_file(".", port, "photos") == 0 && wait_log("f", "files unpacked", 1), "recovery: receiving again");
+    check(stop(receiver) == 0, "recovery: the receiver succeeds");
+}
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    return remove(path);
+}
+
+int main(void) {
+    // the harness gives up rather than hang on a program that never ends
+    alarm(LOOPBACK_TIMEOUT_S);
+    signal(SIGPIPE, SIG_IGN);
+
+    char root[] = "/tmp/aleft-loopback-XXXXXX";
+    if (!realpath("../receiver/receiver", receiverPath) || !realpath("../sender/sender", senderPath)
+        || !mkdtemp(root) || chdir(root) == -1) {
+        perror("Cannot find the programs or make the directory");
+        return EXIT_FAILURE;
+    }
+
+    test_relays();
+    test_pack();
+    test_recovery();
+
+    if (chdir("/") == 0)
+        nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    if (nbFailed > 0) {
+        printf("%d checks FAILED\n", nbFailed);
+        return EXIT_FAILURE;
+    }
+    printf("relays, packs and recovery OK\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This test is a part of the ALEFT Project.
+ *       It checks the names the sender gives to what it sends,
+ *       from the paths and the options it's given.
+ * */
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../sender/sender.h"
+
+/*
+Three levels, each on the same tree, made in a temporary directory:
+
+    photos/a.txt
+    photos/sub/b.txt
+
+    - fix_name(): what's left of a path once its directories are removed
+    - pack_name(): the name of a directory's pack, after the directory the
+      path resolves to ("photos/.", "photos/sub/.."...)
+    - parse_arguments(): the name sent for the -i and -n given, or ERROR
+
+The sender's messages go to /dev/null, only the failed checks are printed.
+*/
+
+static FILE* report;
+static int nbFailed = 0;
+
+static void check_fix_name(const char* path, const char* expected) {
+    char name[ALEFT_FILENAME_LEN];
+    strcpy(name, path);
+    fix_name(name);
+    if (strcmp(name, expected) != 0) {
+        fprintf(report, "fix_name(\"%s\"): \"%s\" instead of \"%s\"\n", path, name, expected);
+        nbFailed++;
+    }
+}
+
+/**
+ * @param expected NULL if the pack can't be named
+ * */
+static void check_pack_name(const char* directory, const char* expected) {
+    char name[ALEFT_FILENAME_LEN];
+    int status = pack_name(directory, name);
+    if (expected ? status != SUCCESS || strcmp(name, expected) != 0 : status != ERROR) {
+        fprintf(report, "pack_name(\"%s\"): %s instead of %s\n", directory,
+                status == SUCCESS ? name : "ERROR", expected ? expected : "ERROR");
+        nbFailed++;
+    }
+}
+
+/**
+ * Parses "-a 127.0.0.1 -p 11037 -i input", followed by -n name if it's not NULL
+ *
+ * @param expected the name sent, NULL if the arguments are refused
+ * */
+static void check_arguments(const char* input, const char* name, const char* expected) {
+    // open_file() writes in its -i, as it can in the real argv
+    char path[PATH_MAX];
+    strcpy(path, input);
+    char* argv[] = { "sender", "-a", "127.0.0.1", "-p", "11037", "-i", path, "-n", (char*) name, NULL };
+    int argc = name ? 9 : 7;
+    File* f = NULL;
+    char ip[IP_LEN] = {0}, port[PORT_LEN] = {0};
+    bool autoTune = false;
+    char* serveDir = NULL;
+
+    optind = 0; // getopt() starts over
+    int status = parse_arguments(argc, argv, &f, ip, port, &autoTune, &serveDir);
+    if (expected ? status != SUCCESS || strcmp(f->name, expected) != 0 : status != ERROR) {
+        fprintf(report, "-i \"%s\"%s%s%s: %s instead of %s\n", input, name ? " -n \"" : "", name ? name : "",
+                name ? "\"" : "", status == SUCCESS ? f->name : "ERROR", expected ? expected : "ERROR");
+        nbFailed++;
+    }
+    if (f)
+        free_file(f);
+}
+
+static int make_tree(void) {
+    char dir[] = "/tmp/aleft-names-XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) == -1 || mkdir("photos", 0700) == -1 || mkdir("photos/sub", 0700) == -1)
+        return ERROR;
+
+    const char* files[] = { "photos/a.txt", "photos/sub/b.txt" };
+    for (int i = 0; i < 2; i++) {
+        int fd = open(files[i], O_WRONLY | O_CREAT, 0600);
+        if (fd == -1 || write(fd, "aleft", 5) != 5)
+            return ERROR;
+        close(fd);
+    }
+    return SUCCESS;
+}
+
+static void remove_tree(void) {
+    unlink("photos/sub/b.txt");
+    unlink("photos/a.txt");
+    rmdir("photos/sub");
+    rmdir("photos");
+    char dir[PATH_MAX];
+    if (getcwd(dir, sizeof dir) && chdir("/") == 0)
+        rmdir(dir);
+}
+
+int main(void) {
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    if (!report || make_tree() == ERROR) {
+        perror("Cannot make the tree");
+        return EXIT_FAILURE;
+    }
+    if (!freopen("/dev/null", "w", stdout) || !freopen("/dev/null", "w", stderr))
+        return EXIT_FAILURE;
+
+    check_fix_name("a.txt", "a.txt");
+    check_fix_name("/home/user/test.txt", "test.txt");
+    check_fix_name("photos/", "photos");
+    check_fix_name("photos///", "photos");
+    check_fix_name("/", "/");
+    check_fix_name("x/.", ".");
+    check_fix_name("sub/..", "..");
+    check_fix_name("", "");
+
+    check_pack_name("photos", "photos"ALEFT_PACK_SUFFIX);
+    check_pack_name("photos/", "photos"ALEFT_PACK_SUFFIX);
+    check_pack_name("photos/.", "photos"ALEFT_PACK_SUFFIX);
+    check_pack_name("photos/sub/..", "photos"ALEFT_PACK_SUFFIX);
+    check_pack_name("photos/sub/../sub/", "sub"ALEFT_PACK_SUFFIX);
+    check_pack_name("/", NULL);
+    check_pack_name("", NULL);
+    check_pack_name("missing", NULL);
+
+    check_arguments("photos/a.txt", NULL, "a.txt");
+    check_arguments("photos/sub/../a.txt", NULL, "a.txt");
+    check_arguments("photos/.", NULL, "photos"ALEFT_PACK_SUFFIX);
+    check_arguments("photos/sub/..", NULL, "photos"ALEFT_PACK_SUFFIX);
+    check_arguments("photos/sub/", NULL, "sub"ALEFT_PACK_SUFFIX);
+    check_arguments("photos", "album", "album"ALEFT_PACK_SUFFIX);
+    check_arguments("photos", "album"ALEFT_PACK_SUFFIX, "album"ALEFT_PACK_SUFFIX);
+    check_arguments("photos/a.txt", "b.txt", "b.txt");
+    check_arguments("photos/a.txt", "", NULL);
+    check_arguments("photos/a.txt", "..", NULL);
+    check_arguments("photos/a.txt", ALEFT_JOURNAL_NAME, NULL);
+    check_arguments("", NULL, NULL);
+    check_arguments("missing", NULL, NULL);
+
+    remove_tree();
+
+    if (nbFailed > 0) {
+        fprintf(report, "%d names WRONG\n", nbFailed);
+        return EXIT_FAILURE;
+    }
+    fprintf(report, "all names OK\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,545 @@
+/**
+ * ALEFT PROJECT
+ *
+ * @author Alexandre E.
+ * @author Lev M.
+ * @date August 2020
+ *
+ * @note This test is a part of the ALEFT Project.
+ *       It runs hundreds of transfers over loopback, many at once,
+ *       checks that every file arrives Byte for Byte, and reports
+ *       how long they took.
+ * */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "../lib/aleft.h"
+
+/*
+Everything runs in one thread: the senders and the receivers are all
+non-blocking sessions, stepped from a single poll() loop, with up to
+STRESS_CONCURRENCY transfers at once. Each transfer is one of:
+
+    - buffer:  aleft_send_buffer(), with a random chunk size, some of them
+               connecting by themselves (aleft_session_connect())
+    - fd:      aleft_send_fd() of a temporary file
+    - stream:  aleft_send_fd() of a pipe, the size isn't known
+    - raw:     the header, the content and the checksum (or the blocks of
+               a stream) written by hand, in random fragments of 1 to
+               STRESS_MAX_FRAGMENT Bytes, one send() each (TCP_NODELAY)
+    - cut:     a raw transfer whose sender disconnects in the middle,
+               the receiver has to fail
+
+A receiver writes the file in memory or in a temporary file, and some
+are slow: a small receive buffer, stepped at most every STRESS_SLOW_MS.
+The latency of a transfer goes from the creation of its sockets until
+its receiver is done.
+
+The run is drawn from a seed, printed first: STRESS_SEED=<seed> ./stress
+replays it. STRESS_CONCURRENCY=<n> changes how many transfers run at once.
+*/
+
+#define STRESS_TRANSFERS 1000
+#define STRESS_CONCURRENCY 256
+#define STRESS_MAX_FRAGMENT 2048
+#define STRESS_FRAGMENTS_PER_TURN 32
+#define STRESS_SLOW_MS 1
+#define STRESS_SLOW_RCVBUF 4096
+#define STRESS_TIMEOUT_S 120
+
+typedef enum { SEND_BUFFER, SEND_FD, SEND_STREAM, SEND_RAW, SEND_CUT, NB_KINDS } Kind;
+
+static const char* kindNames[] = { "buffer", "fd", "stream", "raw", "cut" };
+
+typedef struct {
+    Kind kind;
+    char name[ALEFT_FILENAME_LEN];
+    char* data;
+    size_t size;
+    bool stream;        // sent without its size
+
+    int sendSock;
+    AleftSession* sender;   // NULL for a raw sender
+    int sendStatus;
+    int file;               // what aleft_send_fd() reads, -1 if none
+
+    char* raw;              // what a raw sender writes
+    size_t rawSize, rawDone;
+    size_t rawEnd;          // where a cut sender stops
+
+    int recvSock;
+    AleftSession* receiver;
+    int recvStatus;
+    int sink;               // the file the receiver writes, -1 for memory
+    bool slow;
+    double nextStep;
+
+    double start;
+    unsigned long long random;  // drawn from as the transfer goes, whatever the others do
+} Transfer;
+
+static unsigned long long seed = 0x9e3779b97f4a7c15ULL;
+
+/**
+ * xorshift64*, so that a run can be replayed with the same seed
+ * */
+static unsigned long long next_random(unsigned long long* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+static size_t random_between(unsigned long long* state, size_t min, size_t max) {
+    return min + next_random(state) % (max - min + 1);
+}
+
+static double now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static int by_value(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @return a size drawn so that most files are small, and a few are big
+ * */
+static size_t random_size(Kind kind, bool slow) {
+    size_t max;
+    switch (next_random(&seed) % 8) {
+        case 0:  max = 0; break;
+        case 1:
+        case 2:
+        case 3:  max = 4096; break;
+        case 4:
+        case 5:  max = 256*1024; break;
+        default: max = 4*1024*1024; break;
+    }
+    // a pipe has to hold the whole stream, and a slow reader shouldn't take seconds
+    if (kind == SEND_STREAM && max > 60000)
+        max = 60000;
+    if (slow && max > 64*1024)
+        max = 64*1024;
+    return random_between(&seed, 0, max);
+}
+
+static void append(char** raw, size_t* size, const void* data, size_t len) {
+    memcpy(*raw + *size, data, len);
+    *size += len;
+}
+
+/**
+ * Writes what a sender would send in transfer->raw: the header, the
+ * content (in blocks for a stream), and its checksum
+ * */
+static int build_raw(Transfer* transfer) {
+    size_t maxBlocks = transfer->size + 1;
+    transfer->raw = malloc(ALEFT_HEADER_LEN + transfer->size + maxBlocks * ALEFT_CHUNKSIZE_LEN + ALEFT_CHECKSUM_LEN);
+    if (!transfer->raw)
+        return -1;
+
+    char field[ALEFT_HEADER_LEN+1];
+    aleft_encode_header(field, transfer->name, transfer->stream ? -1 : (long long) transfer->size);
+    append(&transfer->raw, &transfer->rawSize, field, ALEFT_HEADER_LEN);
+
+    if (!transfer->stream)
+        append(&transfer->raw, &transfer->rawSize, transfer->data, transfer->size);
+    else {
+        for (size_t done = 0; done < transfer->size; ) {
+            size_t block = random_between(&seed, 1, transfer->size - done < 5000 ? transfer->size - done : 5000);
+            snprintf(field, sizeof field, "%*zu", ALEFT_CHUNKSIZE_LEN, block);
+            append(&transfer->raw, &transfer->rawSize, field, ALEFT_CHUNKSIZE_LEN);
+            append(&transfer->raw, &transfer->rawSize, transfer->data + done, block);
+            done += block;
+        }
+        snprintf(field, sizeof field, "%*d", ALEFT_CHUNKSIZE_LEN, 0);
+        append(&transfer->raw, &transfer->rawSize, field, ALEFT_CHUNKSIZE_LEN);
+    }
+
+    AleftChecksum checksum;
+    aleft_checksum_init(&checksum);
+    aleft_checksum_update(&checksum, transfer->data, transfer->size);
+    snprintf(field, sizeof field, "%016llx", aleft_checksum_final(&checksum));
+    append(&transfer->raw, &transfer->rawSize, field, ALEFT_CHECKSUM_LEN);
+    return 0;
+}
+
+static int on_header(AleftSession* session, const char* name, long long size, void* user) {
+    Transfer* transfer = user;
+    return transfer->sink;
+}
+
+/**
+ * Creates both ends of a transfer and connects them
+ *
+ * @return -1 if it couldn't be started
+ * */
+static int start_transfer(Transfer* transfer, int index, int listener, const char* ip, const char* port) {
+    memset(transfer, 0, sizeof *transfer);
+    transfer->kind = next_random(&seed) % NB_KINDS;
+    transfer->slow = next_random(&seed) % 5 == 0;
+    transfer->stream = transfer->kind == SEND_STREAM
+                       || ((transfer->kind == SEND_RAW || transfer->kind == SEND_CUT) && next_random(&seed) % 3 == 0);
+    transfer->size = random_size(transfer->kind, transfer->slow);
+    transfer->file = -1;
+    transfer->sink = -1;
+    transfer->sendStatus = ALEFT_AGAIN;
+    transfer->recvStatus = ALEFT_AGAIN;
+    transfer->random = next_random(&seed) | 1;
+    snprintf(transfer->name, sizeof transfer->name, "stress-%d-%s", index, kindNames[transfer->kind]);
+
+    transfer->data = malloc(transfer->size ? transfer->size : 1);
+    if (!transfer->data)
+        return -1;
+    for (size_t i = 0; i < transfer->size; i++)
+        transfer->data[i] = next_random(&seed) >> 56;
+
+    struct sockaddr_storage address;
+    socklen_t addressLen;
+    transfer->start = now_ms();
+    transfer->sendSock = aleft_socket(ip, port, &address, &addressLen);
+    if (transfer->sendSock == -1)
+        return -1;
+
+    switch (transfer->kind) {
+        case SEND_BUFFER:
+            transfer->sender = aleft_send_buffer(transfer->sendSock, transfer->name, transfer->data, transfer->size, NULL);
+            break;
+
+        case SEND_FD: {
+            FILE* file = tmpfile();
+            if (!file || fwrite(transfer->data, 1, transfer->size, file) != transfer->size || fflush(file) != 0)
+                return -1;
+            transfer->file = dup(fileno(file));
+            fclose(file);
+            lseek(transfer->file, 0, SEEK_SET);
+            transfer->sender = aleft_send_fd(transfer->sendSock, transfer->name, transfer->file, transfer->size, NULL);
+        }
+        break;
+
+        case SEND_STREAM: {
+            // the pipe holds the whole stream, so that reading it never blocks
+            int pipefd[2];
+            if (pipe(pipefd) == -1)
+                return -1;
+            bool written = write(pipefd[1], transfer->data, transfer->size) == (ssize_t) transfer->size;
+            close(pipefd[1]);
+            transfer->file = pipefd[0];
+            if (!written)
+                return -1;
+            transfer->sender = aleft_send_fd(transfer->sendSock, transfer->name, transfer->file, -1, NULL);
+        }
+        break;
+
+        default:
+            if (build_raw(transfer) == -1)
+                return -1;
+            transfer->rawEnd = transfer->rawSize;
+            if (transfer->kind == SEND_CUT)
+                transfer->rawEnd = random_between(&seed, 0, transfer->rawSize - 1);
+            break;
+    }
+
+    if (transfer->kind <= SEND_STREAM) {
+        if (!transfer->sender)
+            return -1;
+        // tiny chunks for the smaller files, or a big file would take seconds
+        size_t maxChunk = next_random(&seed) % 2 && transfer->size <= 256*1024 ? 4096 : ALEFT_MAX_CHUNK_SIZE;
+        aleft_session_set_chunk_size(transfer->sender, random_between(&seed, 1, maxChunk));
+    }
+
+    /*
+    A session connecting by itself has sent its SYN after its first step,
+    and a session's socket is already non-blocking. The connections are
+    accepted one at a time, so the socket accepted is the one just connected.
+    */
+    if (transfer->sender && next_random(&seed) % 2) {
+        aleft_session_connect(transfer->sender, (struct sockaddr*) &address, addressLen);
+        transfer->sendStatus = aleft_session_step(transfer->sender);
+    }
+    else if (connect(transfer->sendSock, (struct sockaddr*) &address, addressLen) == -1 && errno != EINPROGRESS)
+        return -1;
+
+    if (!transfer->sender) {
+        int yes = 1;
+        setsockopt(transfer->sendSock, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+        fcntl(transfer->sendSock, F_SETFL, O_NONBLOCK);
+    }
+
+    transfer->recvSock = aleft_accept(listener, NULL, 0);
+    if (transfer->recvSock == -1)
+        return -1;
+    if (transfer->slow) {
+        int size = STRESS_SLOW_RCVBUF;
+        setsockopt(transfer->recvSock, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+    }
+
+    if (next_random(&seed) % 2) {
+        FILE* sink = tmpfile();
+        if (!sink)
+            return -1;
+        transfer->sink = dup(fileno(sink));
+        fclose(sink);
+    }
+    AleftCallbacks callbacks = { .on_header = on_header, .user = transfer };
+    transfer->receiver = aleft_recv(transfer->recvSock, -1, &callbacks);
+    return transfer->receiver ? 0 : -1;
+}
+
+/**
+ * Writes the next fragments of a raw transfer
+ *
+ * @return ALEFT_AGAIN until it's all written, ALEFT_DONE, or ALEFT_ERROR
+ * */
+static int send_raw(Transfer* transfer) {
+    for (int i = 0; i < STRESS_FRAGMENTS_PER_TURN && transfer->rawDone < transfer->rawEnd; i++) {
+        size_t left = transfer->rawEnd - transfer->rawDone;
+        size_t fragment = random_between(&transfer->random, 1, left < STRESS_MAX_FRAGMENT ? left : STRESS_MAX_FRAGMENT);
+        ssize_t sent = send(transfer->sendSock, transfer->raw + transfer->rawDone, fragment, MSG_NOSIGNAL);
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (sent == -1 && errno != EINTR)
+            return ALEFT_ERROR;
+        if (sent > 0)
+            transfer->rawDone += sent;
+    }
+    if (transfer->rawDone < transfer->rawEnd)
+        return ALEFT_AGAIN;
+
+    // the receiver sees the disconnection in the middle of the file
+    if (transfer->kind == SEND_CUT)
+        shutdown(transfer->sendSock, SHUT_WR);
+    return ALEFT_DONE;
+}
+
+/**
+ * @return NULL if the receiver got what was sent, or what differs
+ * */
+static const char* check_transfer(Transfer* transfer) {
+    if (transfer->kind == SEND_CUT)
+        return transfer->recvStatus == ALEFT_ERROR ? NULL : "a file cut in the middle has been accepted";
+    if (transfer->sendStatus != ALEFT_DONE)
+        return "the sender failed";
+    if (transfer->recvStatus != ALEFT_DONE)
+        return aleft_session_error(transfer->receiver);
+    if (strcmp(aleft_session_name(transfer->receiver), transfer->name) != 0)
+        return "wrong name";
+
+    if (transfer->sink == -1) {
+        size_t size = 0;
+        const char* received = aleft_session_buffer(transfer->receiver, &size);
+        if (!received)
+            return "not received in memory";
+        if (size != transfer->size)
+            return "wrong size";
+        if (size && memcmp(received, transfer->data, size) != 0)
+            return "wrong content";
+        return NULL;
+    }
+
+    char* received = malloc(transfer->size + 1);
+    if (!received)
+        return "not enough memory";
+    ssize_t size = pread(transfer->sink, received, transfer->size + 1, 0);
+    const char* error = NULL;
+    if (size != (ssize_t) transfer->size)
+        error = "wrong size";
+    else if (size && memcmp(received, transfer->data, size) != 0)
+        error = "wrong content";
+    free(received);
+    return error;
+}
+
+static void end_transfer(Transfer* transfer) {
+    aleft_session_free(transfer->sender);
+    aleft_session_free(transfer->receiver);
+    if (transfer->file != -1)
+        close(transfer->file);
+    if (transfer->sink != -1)
+        close(transfer->sink);
+    close(transfer->sendSock);
+    close(transfer->recvSock);
+    free(transfer->raw);
+    free(transfer->data);
+}
+
+/**
+ * Adds the sockets transfer waits for to fds
+ * */
+static void watch(Transfer* transfer, struct pollfd* fds, int* nbFds, double now) {
+    if (transfer->sendStatus == ALEFT_AGAIN) {
+        fds[*nbFds].fd = transfer->sender ? aleft_session_wait_fd(transfer->sender) : transfer->sendSock;
+        fds[*nbFds].events = transfer->sender ? aleft_session_events(transfer->sender) : POLLOUT;
+        (*nbFds)++;
+    }
+    if (transfer->recvStatus == ALEFT_AGAIN && !(transfer->slow && now < transfer->nextStep)) {
+        fds[*nbFds].fd = aleft_session_wait_fd(transfer->receiver);
+        fds[*nbFds].events = aleft_session_events(transfer->receiver);
+        (*nbFds)++;
+    }
+}
+
+/**
+ * Moves both ends of transfer forward
+ *
+ * @return true once it's over
+ * */
+static bool step(Transfer* transfer, double now) {
+    if (transfer->sendStatus == ALEFT_AGAIN)
+        transfer->sendStatus = transfer->sender ? aleft_session_step(transfer->sender) : send_raw(transfer);
+
+    if (transfer->recvStatus == ALEFT_AGAIN && !(transfer->slow && now < transfer->nextStep)) {
+        transfer->recvStatus = aleft_session_step(transfer->receiver);
+        transfer->nextStep = now + STRESS_SLOW_MS;
+    }
+
+    // a failed sender leaves its receiver waiting: it's over as well
+    if (transfer->sendStatus == ALEFT_ERROR && transfer->recvStatus == ALEFT_AGAIN) {
+        shutdown(transfer->sendSock, SHUT_RDWR);
+        transfer->recvStatus = aleft_session_step(transfer->receiver);
+    }
+    return transfer->sendStatus != ALEFT_AGAIN && transfer->recvStatus != ALEFT_AGAIN;
+}
+
+int main(void) {
+    if (getenv("STRESS_SEED"))
+        seed = strtoull(getenv("STRESS_SEED"), NULL, 0);
+    printf("seed %#llx\n", seed);
+
+    int concurrency = getenv("STRESS_CONCURRENCY") ? atoi(getenv("STRESS_CONCURRENCY")) : STRESS_CONCURRENCY;
+    if (concurrency < 1) {
+        fprintf(stderr, "STRESS_CONCURRENCY must be a positive number\n");
+        return EXIT_FAILURE;
+    }
+
+    // up to 5 descriptors per transfer: both sockets, the file or the pipe, and the received file
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    // the harness gives up rather than hang on a session that never ends
+    alarm(STRESS_TIMEOUT_S);
+
+    int listener = aleft_listen("0", 2*concurrency);
+    struct sockaddr_storage local;
+    socklen_t localLen = sizeof local;
+    if (listener == -1 || getsockname(listener, (struct sockaddr*) &local, &localLen) == -1) {
+        fprintf(stderr, "Cannot listen\n");
+        return EXIT_FAILURE;
+    }
+    char port[8];
+    const char* ip;
+    if (local.ss_family == AF_INET6) {
+        ip = "::1";
+        snprintf(port, sizeof port, "%d", ntohs(((struct sockaddr_in6*) &local)->sin6_port));
+    }
+    else {
+        ip = "127.0.0.1";
+        snprintf(port, sizeof port, "%d", ntohs(((struct sockaddr_in*) &local)->sin_port));
+    }
+
+    // the sessions keep a pointer to their transfer, which mustn't move
+    Transfer** transfers = malloc(concurrency * sizeof *transfers);
+    // by kind of sender, the slow readers apart (they're slow on purpose)
+    static double latencies[NB_KINDS+1][STRESS_TRANSFERS];
+    struct pollfd* fds = malloc(2*concurrency * sizeof *fds);
+    if (!transfers || !fds) {
+        fprintf(stderr, "Not enough memory\n");
+        return EXIT_FAILURE;
+    }
+    int nbActive = 0, nbStarted = 0, nbFailed = 0;
+    int nbLatencies[NB_KINDS+1] = {0};
+    int counts[NB_KINDS] = {0};
+    unsigned long long bytes = 0;
+    double begin = now_ms();
+
+    while (nbStarted < STRESS_TRANSFERS || nbActive > 0) {
+        while (nbActive < concurrency && nbStarted < STRESS_TRANSFERS) {
+            Transfer* transfer = malloc(sizeof *transfer);
+            if (!transfer || start_transfer(transfer, nbStarted, listener, ip, port) == -1) {
+                fprintf(stderr, "transfer %d: cannot be started: %s\n", nbStarted, strerror(errno));
+                return EXIT_FAILURE;
+            }
+            transfers[nbActive++] = transfer;
+            nbStarted++;
+        }
+
+        int nbFds = 0;
+        double now = now_ms();
+        for (int i = 0; i < nbActive; i++)
+            watch(transfers[i], fds, &nbFds, now);
+        if (poll(fds, nbFds, STRESS_SLOW_MS) == -1 && errno != EINTR) {
+            perror("poll");
+            return EXIT_FAILURE;
+        }
+
+        now = now_ms();
+        for (int i = 0; i < nbActive; i++) {
+            Transfer* transfer = transfers[i];
+            if (!step(transfer, now))
+                continue;
+
+            const char* error = check_transfer(transfer);
+            if (error) {
+                fprintf(stderr, "%s (%zu Bytes, %s%s%s): %s\n", transfer->name, transfer->size,
+                        transfer->stream ? "stream, " : "", transfer->sink == -1 ? "in memory" : "in a file",
+                        transfer->slow ? ", slow" : "", error);
+                nbFailed++;
+            }
+            else if (transfer->kind != SEND_CUT) {
+                int row = transfer->slow ? NB_KINDS : transfer->kind;
+                latencies[row][nbLatencies[row]++] = now_ms() - transfer->start;
+                bytes += transfer->size;
+            }
+            counts[transfer->kind]++;
+            end_transfer(transfer);
+            free(transfer);
+
+            // the last transfer takes the place of the one that ended
+            transfers[i--] = transfers[--nbActive];
+        }
+    }
+    double elapsed = now_ms() - begin;
+    close(listener);
+    free(transfers);
+    free(fds);
+
+    for (int kind = 0; kind < NB_KINDS; kind++)
+        printf("%s: %d  ", kindNames[kind], counts[kind]);
+    printf("\n%d transfers, %d at once, %.1f MB in %.0f ms\n",
+           nbStarted, concurrency, bytes / 1e6, elapsed);
+
+    printf("latency in ms  %8s %8s %8s %8s\n", "median", "p90", "p99", "max");
+    for (int row = 0; row <= NB_KINDS; row++) {
+        int n = nbLatencies[row];
+        if (n == 0)
+            continue;
+        double* sorted = latencies[row];
+        qsort(sorted, n, sizeof *sorted, by_value);
+        printf("%-13s %8.2f %8.2f %8.2f %8.2f\n", row == NB_KINDS ? "slow readers" : kindNames[row],
+               sorted[n / 2], sorted[n * 90 / 100], sorted[n * 99 / 100], sorted[n - 1]);
+    }
+
+    if (nbFailed > 0) {
+        printf("%d transfers FAILED\n", nbFailed);
+        return EXIT_FAILURE;
+    }
+    printf("all transfers OK\n");
+    return EXIT_SUCCESS;
+}